@@ -0,0 +1,259 @@
+#pragma once
+
+#include "Color.hpp"
+#include "Camera.hpp"
+#include "Image.hpp"
+#include "Scene.hpp"
+#include "Render.hpp"
+#include "ParallelRender.hpp"
+#include "Ppm.hpp"
+#include "RenderRequest.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// A batch renders many views of one resident scene: turntables, light field
+// grids, thumbnail sheets. Views are listed one per line, with the arguments
+// of the render server's render command and the file to write:
+//
+//   out=<path> [width=<w>] [height=<h>] [spp=<n>] [depth=<n>] [seed=<n>]
+//              [lookfrom=<x>,<y>,<z>] [lookat=<x>,<y>,<z>] [vfov=<deg>]
+//              [aperture=<a>] [focus=<d>]
+//
+// Empty lines and lines starting with # are skipped.
+template <typename T>
+struct BatchView
+{
+    RenderRequest<T> request;
+    std::string path;
+};
+
+// Parse a view list. Views render with the given seed unless they set their
+// own. On failure, error names the offending line.
+template <typename T>
+bool read_batch_views(
+    const char* path,
+    unsigned seed,
+    std::vector<BatchView<T>>& views,
+    std::string& error)
+{
+    std::ifstream file{path};
+    if (!file)
+    {
+        error = std::string{"could not open "} + path;
+        return false;
+    }
+
+    std::string line;
+    for (int line_number = 1; std::getline(file, line); ++line_number)
+    {
+        const auto first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos || line[first] == '#')
+        {
+            continue;
+        }
+
+        // Take out the output path, the rest is a render request
+        BatchView<T> view;
+        std::istringstream words{line};
+        std::string word, arguments;
+        while (words >> word)
+        {
+            if (word.compare(0, 4, "out=") == 0)
+            {
+                view.path = word.substr(4);
+            }
+            else if (word.compare(0, 6, "scene=") == 0)
+            {
+                error = "line " + std::to_string(line_number) +
+                    ": the scene is the same for the whole batch";
+                return false;
+            }
+            else
+            {
+                arguments += word + ' ';
+            }
+        }
+
+        view.request.seed = seed;
+        std::string request_error;
+        if (!parse_render_request(arguments, view.request, request_error))
+        {
+            error = "line " + std::to_string(line_number) + ": " + request_error;
+            return false;
+        }
+        if (view.path.empty())
+        {
+            error = "line " + std::to_string(line_number) + ": missing out=<path>";
+            return false;
+        }
+
+        views.push_back(std::move(view));
+    }
+
+    return true;
+}
+
+// Counts the rays traced against a hittable
+template <typename T, typename WORLD>
+class RayCounter
+{
+public:
+    explicit RayCounter(const WORLD& world) : m_world{world} {}
+
+    bool hit(
+        const Ray3<Point3<T>, Vec3<T>>& ray,
+        T t_min,
+        T t_max,
+        HitRecord<T>& record) const
+    {
+        ++m_num_rays;
+        return m_world.hit(ray, t_min, t_max, record);
+    }
+
+    std::uint64_t num_rays() const { return m_num_rays; }
+
+private:
+    const WORLD& m_world;
+    mutable std::uint64_t m_num_rays{0};
+};
+
+struct BatchStatistics
+{
+    double seconds{0};
+    std::uint64_t num_pixels{0};
+    std::uint64_t num_samples{0};
+    std::uint64_t num_rays{0};
+};
+
+// Render every view of the batch with one pool of threads, scheduled like
+// generate_image_parallel: make_scene returns a std::unique_ptr to the scene
+// and is called once per NUMA node. The tiles of all views go into one queue,
+// interleaved, so threads keep working on other views while the last tiles
+// of a view are finishing. Each view is written as soon as its last tile is
+// done. Returns false if a file could not be written.
+template <typename T, typename MakeScene>
+bool render_batch(
+    const std::vector<BatchView<T>>& views,
+    MakeScene make_scene,
+    const ParallelRenderOptions& options,
+    BatchStatistics& statistics)
+{
+    using Clock = std::chrono::steady_clock;
+    using SceneType = typename decltype(make_scene())::element_type;
+    using Accelerator = std::decay_t<decltype(std::declval<const SceneType&>().accelerator())>;
+
+    struct ViewState
+    {
+        std::optional<Camera<T>> camera;
+        std::unique_ptr<MappedImage<Color<int>>> image;
+        std::optional<TileGrid> tiles;
+        std::atomic<int> remaining_tiles;
+    };
+
+    struct Tile
+    {
+        int view;
+        int tile;
+    };
+
+    std::unique_ptr<ViewState[]> states{new ViewState[views.size()]};
+    std::vector<int> num_tiles(views.size());
+    for (std::size_t v = 0; v < views.size(); ++v)
+    {
+        const auto& request = views[v].request;
+        auto& state = states[v];
+        state.camera.emplace(
+            request.lookfrom,
+            request.lookat,
+            Vec3<T>{0, 1, 0},
+            request.vfov,
+            (T)request.width/request.height,
+            request.aperture,
+            request.focus_dist);
+        state.image = std::make_unique<MappedImage<Color<int>>>(request.width, request.height);
+        state.tiles.emplace(request.width, request.height, options.tile_size);
+        num_tiles[v] = state.tiles->num_tiles();
+        state.remaining_tiles = num_tiles[v];
+
+        statistics.num_pixels += (std::uint64_t)request.width * request.height;
+        statistics.num_samples +=
+            (std::uint64_t)request.width * request.height * request.num_samples_per_pixel;
+    }
+
+    // Take a tile of every view in turn
+    std::vector<Tile> queue;
+    const int max_tiles = *std::max_element(num_tiles.begin(), num_tiles.end());
+    for (int tile = 0; tile < max_tiles; ++tile)
+    {
+        for (std::size_t v = 0; v < views.size(); ++v)
+        {
+            if (tile < num_tiles[v])
+            {
+                queue.push_back({(int)v, tile});
+            }
+        }
+    }
+
+    std::atomic<std::uint64_t> num_rays{0};
+    std::atomic<bool> written{true};
+    const auto start = Clock::now();
+
+    auto render_tile = [&](int i, const SceneType& scene) {
+        const auto& view = views[queue[i].view];
+        const auto& request = view.request;
+        auto& state = states[queue[i].view];
+        auto& image = *state.image;
+
+        const auto bounds = state.tiles->bounds(queue[i].tile);
+        RayCounter<T, Accelerator> world{scene.accelerator()};
+        for (int x = bounds.x_begin; x < bounds.x_end; ++x)
+        {
+            for (int y = bounds.y_begin; y < bounds.y_end; ++y)
+            {
+                image[x][y] = to_pixel(sample_pixel_deterministic<T>(
+                    x, y, request.width, request.height,
+                    world, *state.camera,
+                    request.num_samples_per_pixel, request.max_depth,
+                    request.seed));
+            }
+        }
+        num_rays += world.num_rays();
+
+        if (--state.remaining_tiles > 0)
+        {
+            return;
+        }
+
+        FILE* file = fopen(view.path.c_str(), "w");
+        if (file == nullptr)
+        {
+            fprintf(stderr, "Could not open %s\n", view.path.c_str());
+            written = false;
+        }
+        else
+        {
+            print_ppm_image(image, file);
+            fclose(file);
+        }
+        state.image.reset();
+    };
+
+    for_each_tile_parallel((int)queue.size(), make_scene, render_tile, options);
+
+    const std::chrono::duration<double> elapsed = Clock::now() - start;
+    statistics.seconds = elapsed.count();
+    statistics.num_rays = num_rays;
+    return written;
+}
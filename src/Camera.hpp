@@ -31,6 +31,8 @@ public:
         T theta = vfov * M_PI / 180;
         T half_height = tan(theta/2);
         T half_width = aspect * half_height;
+        m_half_width = half_width;
+        m_half_height = half_height;
 
         m_w = unit_vector(make_vec(lookfrom, lookat));
         m_u = unit_vector(cross(vup, m_w));
@@ -56,11 +58,43 @@ public:
                      v * m_vertical, m_origin + offset)
         };
     }
+
+    // A ray through the center of the lens, ignoring depth of field
+    Ray3<Point3<T>, Vec3<T>> get_pinhole_ray(T u, T v) const
+    {
+        return {
+            m_origin,
+            make_vec(m_lower_left_corner +
+                     u * m_horizontal +
+                     v * m_vertical, m_origin)
+        };
+    }
+
+    // Find the (u, v) screen coordinates that point p projects to. Returns
+    // false if the point is behind the camera.
+    bool project(const Point3<T>& p, T& u, T& v) const
+    {
+        auto d = make_vec(p, m_origin);
+        auto depth = -dot(d, m_w);
+        if (depth <= 0)
+        {
+            return false;
+        }
+
+        u = (dot(d, m_u) / (depth * m_half_width) + 1) / 2;
+        v = (dot(d, m_v) / (depth * m_half_height) + 1) / 2;
+        return true;
+    }
+
+    Point3<T> origin() const { return m_origin; }
+
 private:
     Point3<T> m_lower_left_corner;
     Vec3<T> m_horizontal;
     Vec3<T> m_vertical;
     Point3<T> m_origin;
     Vec3<T> m_u, m_v, m_w;
+    T m_half_width{};
+    T m_half_height{};
     T m_lens_radius;
 };
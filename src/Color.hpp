@@ -52,7 +52,7 @@ inline Color<T> operator/(const Color<T>& c, T t)
 template <typename T>
 inline Color<T> gamma_correct(const Color<T>& c)
 {
-    return { sqrt(c.r()), sqrt(c.g()), sqrt(c.b()) };
+    return { std::sqrt(c.r()), std::sqrt(c.g()), std::sqrt(c.b()) };
 }
 
 template <typename T>
@@ -0,0 +1,128 @@
+#pragma once
+
+#include "Point.hpp"
+#include "Vec.hpp"
+#include "Camera.hpp"
+#include "RenderRequest.hpp"
+
+#include <fstream>
+#include <sstream>
+#include <string>
+
+// Settings of a render, given at run time instead of being compiled in. They
+// are read from a file (--config) and from key=value arguments on the command
+// line, later settings overriding earlier ones. The keys are those of the
+// render server's render command, without scene, seed and priority, plus
+//
+//   precision=float|double   math=exact|fast
+//
+// In a file, settings may be spread over several lines; empty lines and lines
+// starting with # are skipped.
+struct RenderConfig
+{
+    enum Precision { single_precision, double_precision };
+    enum Math { exact_math, fast_math };
+
+    RenderRequest<double> request;
+    Precision precision{double_precision};
+    Math math{exact_math};
+
+    template <typename T>
+    Camera<T> camera() const
+    {
+        const auto& from = request.lookfrom;
+        const auto& at = request.lookat;
+        return {
+            Point3<T>{(T)from.x(), (T)from.y(), (T)from.z()},
+            Point3<T>{(T)at.x(), (T)at.y(), (T)at.z()},
+            Vec3<T>{0, 1, 0},
+            (T)request.vfov,
+            (T)request.width/request.height,
+            (T)request.aperture,
+            (T)request.focus_dist
+        };
+    }
+};
+
+// Apply key=value settings to config. On failure, error describes the
+// offending setting and config may be partly updated.
+inline bool parse_render_config(
+    const std::string& arguments,
+    RenderConfig& config,
+    std::string& error)
+{
+    std::istringstream words{arguments};
+    std::string word, request_arguments;
+    while (words >> word)
+    {
+        if (word == "precision=float")
+        {
+            config.precision = RenderConfig::single_precision;
+        }
+        else if (word == "precision=double")
+        {
+            config.precision = RenderConfig::double_precision;
+        }
+        else if (word == "math=exact")
+        {
+            config.math = RenderConfig::exact_math;
+        }
+        else if (word == "math=fast")
+        {
+            config.math = RenderConfig::fast_math;
+        }
+        else if (word.compare(0, 10, "precision=") == 0 ||
+                 word.compare(0, 5, "math=") == 0)
+        {
+            error = "bad value: " + word;
+            return false;
+        }
+        else if (word.compare(0, 6, "scene=") == 0 ||
+                 word.compare(0, 5, "seed=") == 0 ||
+                 word.compare(0, 9, "priority=") == 0)
+        {
+            error = "not a render setting: " + word;
+            return false;
+        }
+        else
+        {
+            request_arguments += word + ' ';
+        }
+    }
+
+    return parse_render_request(request_arguments, config.request, error);
+}
+
+// Apply the settings in a file to config. On failure, error names the
+// offending line.
+inline bool read_render_config(
+    const char* path,
+    RenderConfig& config,
+    std::string& error)
+{
+    std::ifstream file{path};
+    if (!file)
+    {
+        error = std::string{"could not open "} + path;
+        return false;
+    }
+
+    std::string line;
+    for (int line_number = 1; std::getline(file, line); ++line_number)
+    {
+        const auto first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos || line[first] == '#')
+        {
+            continue;
+        }
+
+        std::string line_error;
+        if (!parse_render_config(line, config, line_error))
+        {
+            error = "line " + std::to_string(line_number) + ": " + line_error;
+            return false;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,352 @@
+#pragma once
+
+#include "Point.hpp"
+#include "Vec.hpp"
+#include "VecMath.hpp"
+#include "Ray.hpp"
+#include "HitRecord.hpp"
+#include "Hit.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// A uniform grid over the spheres of a container, traversed with a 3D-DDA
+// (Amanatides and Woo). It suits scenes whose spheres are spread evenly and
+// are of similar size. Spheres much larger than the typical one, like a
+// ground sphere, would overlap every cell, so they are kept in a separate
+// list that is tested for every ray instead.
+template <typename T, typename SPHERE_CONTAINER>
+class UniformGrid : public Hittable<T>
+{
+public:
+    // density is the number of cells per sphere the resolution aims for.
+    // Spheres with a radius above large_factor times the median radius are
+    // not put in the grid.
+    UniformGrid(SPHERE_CONTAINER& spheres, T density = 2, T large_factor = 8)
+        :
+        m_spheres{spheres}
+    {
+        build(density, large_factor);
+    }
+
+    bool hit(
+        const Ray3<Point3<T>, Vec3<T>>& ray,
+        T t_min,
+        T t_max,
+        HitRecord<T>& record) const override
+    {
+        return closest_hit_record(*this, ray, t_min, t_max, record);
+    }
+
+    // Primitives are numbered as in the sphere container
+    bool closest_hit(
+        const Ray3<Point3<T>, Vec3<T>>& ray,
+        T t_min,
+        T t_max,
+        PrimitiveHit<T>& hit) const
+    {
+        bool hit_anything = false;
+        auto closest_so_far = t_max;
+
+        for (auto index : m_large)
+        {
+            T t;
+            if (m_spheres[index].intersect(ray, t_min, closest_so_far, t))
+            {
+                hit_anything = true;
+                closest_so_far = t;
+                hit = {t, index};
+            }
+        }
+
+        walk_cells(ray, t_min, closest_so_far, [&](std::size_t cell) {
+            for (auto i = m_cell_start[cell]; i < m_cell_start[cell + 1]; ++i)
+            {
+                T t;
+                if (m_spheres[m_cell_spheres[i]].intersect(ray, t_min, closest_so_far, t))
+                {
+                    hit_anything = true;
+                    closest_so_far = t;
+                    hit = {t, m_cell_spheres[i]};
+                }
+            }
+            return closest_so_far;
+        });
+
+        return hit_anything;
+    }
+
+    // Visit the cells the ray passes through between t_min and t_max, in
+    // order. visit(cell) returns the distance to the closest hit found so
+    // far; cells beyond it are not visited.
+    template <typename VISIT>
+    void walk_cells(
+        const Ray3<Point3<T>, Vec3<T>>& ray,
+        T t_min,
+        T t_max,
+        VISIT&& visit) const
+    {
+        if (m_cell_start.empty())
+        {
+            return;
+        }
+
+        // Clip the ray to the bounds of the grid
+        const auto origin = ray.origin();
+        const auto direction = ray.direction();
+        const T o[3] = {origin.x(), origin.y(), origin.z()};
+        const T d[3] = {direction.x(), direction.y(), direction.z()};
+
+        T t_enter = t_min;
+        T t_exit = t_max;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            const T inverse = 1 / d[axis];
+            T t0 = (m_lower[axis] - o[axis]) * inverse;
+            T t1 = (m_upper[axis] - o[axis]) * inverse;
+            if (t0 > t1)
+            {
+                std::swap(t0, t1);
+            }
+            // Written so that NaN (ray parallel to and on a slab plane) keeps
+            // the current bounds
+            t_enter = t0 > t_enter ? t0 : t_enter;
+            t_exit = t1 < t_exit ? t1 : t_exit;
+            if (t_enter > t_exit)
+            {
+                return;
+            }
+        }
+
+        // Set up the DDA in the cell where the ray enters the grid
+        int cell[3];
+        int step[3];
+        T t_next[3];
+        T t_delta[3];
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            const T p = o[axis] + t_enter * d[axis];
+            cell[axis] = std::clamp(
+                (int)((p - m_lower[axis]) * m_inverse_cell_size[axis]),
+                0, m_resolution[axis] - 1);
+
+            if (d[axis] > 0)
+            {
+                step[axis] = 1;
+                t_delta[axis] = m_cell_size[axis] / d[axis];
+                t_next[axis] = (m_lower[axis] + (cell[axis] + 1) * m_cell_size[axis] - o[axis]) / d[axis];
+            }
+            else if (d[axis] < 0)
+            {
+                step[axis] = -1;
+                t_delta[axis] = -m_cell_size[axis] / d[axis];
+                t_next[axis] = (m_lower[axis] + cell[axis] * m_cell_size[axis] - o[axis]) / d[axis];
+            }
+            else
+            {
+                step[axis] = 0;
+                t_delta[axis] = std::numeric_limits<T>::max();
+                t_next[axis] = std::numeric_limits<T>::max();
+            }
+        }
+
+        for (;;)
+        {
+            const T closest_so_far = visit(cell_index(cell[0], cell[1], cell[2]));
+
+            // Move to the neighbouring cell the ray reaches first. A hit
+            // before the ray leaves the cell cannot be beaten by a sphere in
+            // a cell further along.
+            const int axis = t_next[0] < t_next[1] ?
+                (t_next[0] < t_next[2] ? 0 : 2) :
+                (t_next[1] < t_next[2] ? 1 : 2);
+
+            if (closest_so_far <= t_next[axis] || t_next[axis] > t_exit)
+            {
+                break;
+            }
+
+            cell[axis] += step[axis];
+            if (cell[axis] < 0 || cell[axis] >= m_resolution[axis])
+            {
+                break;
+            }
+            t_next[axis] += t_delta[axis];
+        }
+    }
+
+    void set_hit_record(
+        const Ray3<Point3<T>, Vec3<T>>& ray,
+        const PrimitiveHit<T>& hit,
+        HitRecord<T>& record) const
+    {
+        m_spheres[hit.primitive].set_hit_record(ray, hit.t, record);
+    }
+
+    std::size_t num_primitives() const { return m_spheres.size(); }
+
+    const int* resolution() const { return m_resolution; }
+    const T* lower() const { return m_lower; }
+    const T* upper() const { return m_upper; }
+    std::size_t num_large() const { return m_large.size(); }
+    const std::vector<std::uint32_t>& large_spheres() const { return m_large; }
+
+    std::size_t num_cells() const
+    {
+        return m_cell_start.empty() ? 0 : m_cell_start.size() - 1;
+    }
+
+    // The spheres overlapping a cell, as a range of indices
+    std::pair<const std::uint32_t*, const std::uint32_t*> cell_spheres(std::size_t cell) const
+    {
+        return {
+            m_cell_spheres.data() + m_cell_start[cell],
+            m_cell_spheres.data() + m_cell_start[cell + 1]};
+    }
+
+private:
+    using Sphere = typename std::remove_const<SPHERE_CONTAINER>::type::value_type;
+
+    std::size_t cell_index(int x, int y, int z) const
+    {
+        return ((std::size_t)z * m_resolution[1] + y) * m_resolution[0] + x;
+    }
+
+    void build(T density, T large_factor)
+    {
+        const auto num_spheres = m_spheres.size();
+        if (num_spheres == 0)
+        {
+            return;
+        }
+
+        std::vector<T> radii;
+        for (const auto& sphere : m_spheres)
+        {
+            radii.push_back(sphere.radius());
+        }
+        std::nth_element(radii.begin(), radii.begin() + radii.size() / 2, radii.end());
+        const auto large_radius = large_factor * radii[radii.size() / 2];
+
+        std::vector<std::uint32_t> small;
+        for (std::uint32_t i = 0; i < num_spheres; ++i)
+        {
+            if (m_spheres[i].radius() > large_radius)
+            {
+                m_large.push_back(i);
+            }
+            else
+            {
+                small.push_back(i);
+            }
+        }
+
+        if (small.empty())
+        {
+            return;
+        }
+
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            m_lower[axis] = std::numeric_limits<T>::max();
+            m_upper[axis] = std::numeric_limits<T>::lowest();
+        }
+        for (auto i : small)
+        {
+            const auto lower = bounds_lower(m_spheres[i]);
+            const auto upper = bounds_upper(m_spheres[i]);
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                m_lower[axis] = std::min(m_lower[axis], lower[axis]);
+                m_upper[axis] = std::max(m_upper[axis], upper[axis]);
+            }
+        }
+
+        // Pick cubic-ish cells so that there are about density cells per
+        // sphere, the usual heuristic for uniform grids
+        T extent[3];
+        T volume = 1;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            extent[axis] = std::max(m_upper[axis] - m_lower[axis], (T)1e-6);
+            volume *= extent[axis];
+        }
+        const T cells_per_unit = std::cbrt(density * small.size() / volume);
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            m_resolution[axis] = std::clamp((int)std::ceil(extent[axis] * cells_per_unit), 1, 256);
+            m_cell_size[axis] = extent[axis] / m_resolution[axis];
+            m_inverse_cell_size[axis] = 1 / m_cell_size[axis];
+        }
+
+        // Count the spheres overlapping each cell, then fill the cells
+        const std::size_t num_cells =
+            (std::size_t)m_resolution[0] * m_resolution[1] * m_resolution[2];
+        m_cell_start.assign(num_cells + 1, 0);
+
+        auto for_each_cell = [this](const Sphere& sphere, auto&& function) {
+            const auto lower = bounds_lower(sphere);
+            const auto upper = bounds_upper(sphere);
+            int first[3], last[3];
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                first[axis] = std::clamp((int)((lower[axis] - m_lower[axis]) * m_inverse_cell_size[axis]), 0, m_resolution[axis] - 1);
+                last[axis] = std::clamp((int)((upper[axis] - m_lower[axis]) * m_inverse_cell_size[axis]), 0, m_resolution[axis] - 1);
+            }
+            for (int z = first[2]; z <= last[2]; ++z)
+                for (int y = first[1]; y <= last[1]; ++y)
+                    for (int x = first[0]; x <= last[0]; ++x)
+                        function(cell_index(x, y, z));
+        };
+
+        for (auto i : small)
+        {
+            for_each_cell(m_spheres[i], [this](std::size_t cell) { ++m_cell_start[cell + 1]; });
+        }
+        for (std::size_t cell = 0; cell < num_cells; ++cell)
+        {
+            m_cell_start[cell + 1] += m_cell_start[cell];
+        }
+
+        m_cell_spheres.resize(m_cell_start[num_cells]);
+        std::vector<std::uint32_t> fill(m_cell_start.begin(), m_cell_start.end() - 1);
+        for (auto i : small)
+        {
+            for_each_cell(m_spheres[i], [&](std::size_t cell) { m_cell_spheres[fill[cell]++] = i; });
+        }
+    }
+
+    static std::array<T, 3> bounds_lower(const Sphere& sphere)
+    {
+        const auto c = sphere.center();
+        const auto r = sphere.radius();
+        return {c.x() - r, c.y() - r, c.z() - r};
+    }
+
+    static std::array<T, 3> bounds_upper(const Sphere& sphere)
+    {
+        const auto c = sphere.center();
+        const auto r = sphere.radius();
+        return {c.x() + r, c.y() + r, c.z() + r};
+    }
+
+    SPHERE_CONTAINER& m_spheres;
+    std::vector<std::uint32_t> m_large;
+
+    T m_lower[3]{};
+    T m_upper[3]{};
+    int m_resolution[3]{};
+    T m_cell_size[3]{};
+    T m_inverse_cell_size[3]{};
+
+    // Sphere indices of cell c are m_cell_spheres[m_cell_start[c]] up to
+    // m_cell_spheres[m_cell_start[c + 1]]
+    std::vector<std::uint32_t> m_cell_start;
+    std::vector<std::uint32_t> m_cell_spheres;
+};
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+// 64 bit FNV-1a hash
+inline std::uint64_t hash_bytes(const void* data, std::size_t size,
+                                std::uint64_t hash = 14695981039346656037ull)
+{
+    auto bytes = static_cast<const unsigned char*>(data);
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// Continue a hash with the bytes of a value, which must not have padding
+template <typename VALUE>
+std::uint64_t hash_value(const VALUE& value,
+                         std::uint64_t hash = 14695981039346656037ull)
+{
+    static_assert(std::is_trivially_copyable<VALUE>::value, "hash_value needs plain data");
+    return hash_bytes(&value, sizeof(value), hash);
+}
+
+inline std::uint64_t hash_string(const char* text,
+                                 std::uint64_t hash = 14695981039346656037ull)
+{
+    return hash_bytes(text, strlen(text), hash);
+}
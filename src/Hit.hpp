@@ -13,3 +13,29 @@ class Hittable
         T t_min, T t_max,
         HitRecord<T>& hit_record) const = 0;
 };
+
+// Closest hit against a structure that separates finding the closest
+// primitive from computing its hit attributes. It needs
+//
+//   bool closest_hit(ray, t_min, t_max, PrimitiveHit<T>&) const
+//   void set_hit_record(ray, const PrimitiveHit<T>&, HitRecord<T>&) const
+//
+// The first only compares distances, so the point, normal and material are
+// computed once for the closest primitive instead of for every closer
+// candidate met along the way.
+template <typename T, typename STRUCTURE>
+bool closest_hit_record(
+    const STRUCTURE& structure,
+    const Ray3<Point3<T>, Vec3<T>>& ray,
+    T t_min,
+    T t_max,
+    HitRecord<T>& record)
+{
+    PrimitiveHit<T> hit;
+    if (!structure.closest_hit(ray, t_min, t_max, hit))
+    {
+        return false;
+    }
+    structure.set_hit_record(ray, hit, record);
+    return true;
+}
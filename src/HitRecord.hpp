@@ -3,6 +3,8 @@
 #include "Point.hpp"
 #include "Vec.hpp"
 
+#include <cstdint>
+
 template <typename T>
 class Material;
 
@@ -15,3 +17,12 @@ struct HitRecord
     const Material<T>* material;
     bool front_face;
 };
+
+// The closest hit found by a distance-only traversal: where along the ray,
+// and which primitive of the structure that was traversed
+template <typename T>
+struct PrimitiveHit
+{
+    T t;
+    std::uint32_t primitive;
+};
@@ -1,6 +1,9 @@
 #pragma once
 
 #include <cstddef>
+#include <new>
+
+#include <sys/mman.h>
 
 template <typename PIXEL_TYPE, int WIDTH, int HEIGHT>
 class Image
@@ -21,3 +24,50 @@ public:
 private:
     PIXEL_TYPE m_image[WIDTH][HEIGHT] = {};
 };
+
+// An image whose size is chosen at run time, stored in freshly mapped pages.
+// The pixels are not written on construction, so each page is placed on the
+// NUMA node of the thread that first writes to it.
+template <typename PIXEL_TYPE>
+class MappedImage
+{
+public:
+    MappedImage(int w, int h)
+        :
+        width{w},
+        height{h},
+        m_size{sizeof(PIXEL_TYPE) * w * h}
+    {
+        void* pixels = mmap(nullptr, m_size, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (pixels == MAP_FAILED)
+        {
+            throw std::bad_alloc{};
+        }
+        m_image = static_cast<PIXEL_TYPE*>(pixels);
+    }
+
+    ~MappedImage()
+    {
+        munmap(m_image, m_size);
+    }
+
+    PIXEL_TYPE* operator[](std::size_t column)
+    {
+        return m_image + column * height;
+    }
+
+    const PIXEL_TYPE* operator[](std::size_t column) const
+    {
+        return m_image + column * height;
+    }
+
+    const int width;
+    const int height;
+private:
+    MappedImage(const MappedImage&) = delete;
+    MappedImage& operator=(const MappedImage&) = delete;
+
+    std::size_t m_size;
+    PIXEL_TYPE* m_image;
+};
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "Config.hpp"
+#include "Math.hpp"
+#include "Scene.hpp"
+#include "Render.hpp"
+#include "ParallelRender.hpp"
+
+#include <memory>
+
+// The render loop of the generated scene, compiled for one precision T, math
+// policy MATH and depth limit, an int for any limit or a FixedDepth.
+// prepare_scene is called on every new scene before it is rendered, for
+// instance to apply edits. It is checked first on a scene that is then
+// thrown away, so that every NUMA node still builds its own replica on its
+// own CPUs: if it returns false, so does render_kernel, without rendering.
+// The replicas are built the same way, so it succeeds on them too.
+template <typename T, typename MATH, typename Image, typename Depth, typename PrepareScene>
+bool render_kernel(
+    Image& image,
+    const RenderConfig& config,
+    Depth max_depth,
+    unsigned scene_seed,
+    const ParallelRenderOptions& options,
+    const PrepareScene& prepare_scene)
+{
+    {
+        Scene<T, MATH> checked_scene{scene_seed};
+        if (!prepare_scene(checked_scene))
+        {
+            return false;
+        }
+    }
+
+    generate_image_parallel<T>(
+        image,
+        [&] {
+            auto scene = std::make_unique<Scene<T, MATH>>(scene_seed);
+            prepare_scene(*scene);
+            return std::unique_ptr<const Scene<T, MATH>>{std::move(scene)};
+        },
+        config.camera<T>(), config.request.num_samples_per_pixel, max_depth,
+        scene_seed, options);
+    return true;
+}
+
+// The common depth limits have kernels of their own; any other limit is
+// rendered by the generic kernel, which checks the depth at run time
+template <typename T, typename MATH, typename Image, typename PrepareScene>
+bool render_with_depth(
+    Image& image,
+    const RenderConfig& config,
+    unsigned scene_seed,
+    const ParallelRenderOptions& options,
+    const PrepareScene& prepare_scene)
+{
+    switch (config.request.max_depth)
+    {
+    case 8:
+        return render_kernel<T, MATH>(image, config, FixedDepth<8>{}, scene_seed, options, prepare_scene);
+    case 16:
+        return render_kernel<T, MATH>(image, config, FixedDepth<16>{}, scene_seed, options, prepare_scene);
+    case 50:
+        return render_kernel<T, MATH>(image, config, FixedDepth<50>{}, scene_seed, options, prepare_scene);
+    default:
+        return render_kernel<T, MATH>(image, config, config.request.max_depth, scene_seed, options, prepare_scene);
+    }
+}
+
+template <typename T, typename Image, typename PrepareScene>
+bool render_with_math(
+    Image& image,
+    const RenderConfig& config,
+    unsigned scene_seed,
+    const ParallelRenderOptions& options,
+    const PrepareScene& prepare_scene)
+{
+    if (config.math == RenderConfig::fast_math)
+    {
+        return render_with_depth<T, FastMath>(image, config, scene_seed, options, prepare_scene);
+    }
+    else
+    {
+        return render_with_depth<T, ExactMath>(image, config, scene_seed, options, prepare_scene);
+    }
+}
+
+// Render the scene generated from scene_seed with the kernel that matches
+// config. The choice is made once, before any pixel is rendered. Returns
+// false, without rendering, if prepare_scene fails.
+template <typename Image, typename PrepareScene>
+bool render_configured(
+    Image& image,
+    const RenderConfig& config,
+    unsigned scene_seed,
+    const ParallelRenderOptions& options,
+    const PrepareScene& prepare_scene)
+{
+    if (config.precision == RenderConfig::single_precision)
+    {
+        return render_with_math<float>(image, config, scene_seed, options, prepare_scene);
+    }
+    else
+    {
+        return render_with_math<double>(image, config, scene_seed, options, prepare_scene);
+    }
+}
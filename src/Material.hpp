@@ -4,6 +4,10 @@
 #include "Ray.hpp"
 
 #include "Random.hpp"
+#include "Hash.hpp"
+
+#include <cmath>
+#include <cstdint>
 
 template <typename T>
 class Material
@@ -15,6 +19,9 @@ public:
         Vec3<T>& attenuation,
         Ray3<Point3<T>, Vec3<T>>& scattered,
         Rng& rng) const = 0;
+
+    // Changes whenever the material would scatter differently
+    virtual std::uint64_t content_hash() const = 0;
 };
 
 template <typename T>
@@ -31,7 +38,7 @@ Vec3<T> random_in_unit_sphere(Rng& rng)
     return p;
 }
 
-template <typename T>
+template <typename T, typename MATH = ExactMath>
 class Lambertian : public Material<T>
 {
 public:
@@ -52,11 +59,17 @@ public:
         return true;
     }
 
+    std::uint64_t content_hash() const override
+    {
+        const T parameters[] = {m_albedo.x(), m_albedo.y(), m_albedo.z()};
+        return hash_value(parameters, hash_string("lambertian"));
+    }
+
 private:
     Vec3<T> m_albedo;
 };
 
-template <typename T>
+template <typename T, typename MATH = ExactMath>
 class Metal : public Material<T>
 {
 public:
@@ -73,14 +86,20 @@ public:
         Ray3<Point3<T>, Vec3<T>>& scattered,
         Rng& rng) const override
     {
-        auto reflected = reflect(
-             unit_vector(ray.direction()), hit_record.normal);
+        auto reflected = reflect<T, MATH>(
+             unit_vector<T, MATH>(ray.direction()), hit_record.normal);
         scattered = {
             hit_record.p,
             reflected + m_fuzz * random_in_unit_sphere<T>(rng)
         };
         attenuation = m_albedo;
-        return dot(scattered.direction(), hit_record.normal) > 0;
+        return dot<T, MATH>(scattered.direction(), hit_record.normal) > 0;
+    }
+
+    std::uint64_t content_hash() const override
+    {
+        const T parameters[] = {m_albedo.x(), m_albedo.y(), m_albedo.z(), m_fuzz};
+        return hash_value(parameters, hash_string("metal"));
     }
 
 private:
@@ -88,24 +107,24 @@ private:
     T m_fuzz;
 };
 
-template <typename T>
+template <typename T, typename MATH = ExactMath>
 Vec3<T> refract(const Vec3<T>& v, const Vec3<T> n, T ni_over_nt)
 {
-    auto cosine = std::min(dot(-v, n), (T)1);
+    auto cosine = std::min(dot<T, MATH>(-v, n), (T)1);
     Vec3<T> r_out_perp = ni_over_nt * (v + cosine * n);
-    Vec3<T> r_out_parallel = -sqrt(abs(1 - r_out_perp.squared_length())) * n;
+    Vec3<T> r_out_parallel = -MATH::sqrt(std::abs(1 - r_out_perp.squared_length())) * n;
     return r_out_perp + r_out_parallel;
 }
 
-template <typename T>
+template <typename T, typename MATH = ExactMath>
 T reflectance(T cosine, T ref_idx)
 {
     // Schlick's approximation
-    auto r0 = (1 - ref_idx) / (1 + ref_idx);
-    return r0 * r0 + (1 - r0 * r0) * pow(1 - cosine, 5);
+    auto r0 = MATH::divide(1 - ref_idx, 1 + ref_idx);
+    return r0 * r0 + (1 - r0 * r0) * MATH::pow5(1 - cosine);
 }
 
-template <typename T>
+template <typename T, typename MATH = ExactMath>
 class Dialectric : public Material<T>
 {
 public:
@@ -124,23 +143,28 @@ public:
         auto refraction_ratio = hit_record.front_face ?
             1 / m_refraction_index : m_refraction_index;
 
-        auto unit_direction = unit_vector(ray.direction());
+        auto unit_direction = unit_vector<T, MATH>(ray.direction());
 
-        auto cosine = std::min(dot(-unit_direction, hit_record.normal), (T)1);
-        auto sine   = sqrt(1 - cosine * cosine);
+        auto cosine = std::min(dot<T, MATH>(-unit_direction, hit_record.normal), (T)1);
+        auto sine   = MATH::sqrt(1 - cosine * cosine);
 
         bool cannot_refract = refraction_ratio * sine > 1;
 
         Vec3<T> direction =
-            cannot_refract || reflectance(cosine, refraction_ratio) > rng.random<T>() ?
-            reflect(unit_direction, hit_record.normal) :
-            refract(unit_direction, hit_record.normal, refraction_ratio);
+            cannot_refract || reflectance<T, MATH>(cosine, refraction_ratio) > rng.random<T>() ?
+            reflect<T, MATH>(unit_direction, hit_record.normal) :
+            refract<T, MATH>(unit_direction, hit_record.normal, refraction_ratio);
 
         scattered = {hit_record.p, direction};
 
         return true;
     }
 
+    std::uint64_t content_hash() const override
+    {
+        return hash_value(m_refraction_index, hash_string("dialectric"));
+    }
+
 private:
     T m_refraction_index;
 };
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+template <typename T>
+class Vec3;
+
+// Math policies decide how the hot vector and material math is computed.
+// Vector functions, Sphere3, the materials and Scene take one as a template
+// parameter that defaults to ExactMath.
+//
+// ExactMath is the plain implementation; renders with it are unchanged.
+struct ExactMath
+{
+    template <typename T>
+    static constexpr T sqrt(T x) { return std::sqrt(x); }
+
+    template <typename T>
+    static constexpr T pow5(T x) { return std::pow(x, 5); }
+
+    template <typename T>
+    static constexpr T divide(T a, T b) { return a / b; }
+
+    template <typename T>
+    static constexpr Vec3<T> divide(const Vec3<T>& v, T t) { return v / t; }
+
+    template <typename T>
+    static constexpr T dot(const Vec3<T>& v1, const Vec3<T>& v2)
+    {
+        return v1.x() * v2.x() + v1.y() * v2.y() + v1.z() * v2.z();
+    }
+
+    template <typename T>
+    static constexpr Vec3<T> cross(const Vec3<T>& v1, const Vec3<T>& v2)
+    {
+        return {
+            v1.y() * v2.z() - v1.z() * v2.y(),
+            v1.z() * v2.x() - v1.x() * v2.z(),
+            v1.x() * v2.y() - v1.y() * v2.x()
+        };
+    }
+
+    template <typename T>
+    static constexpr Vec3<T> unit_vector(const Vec3<T>& v) { return v / v.length(); }
+};
+
+// FastMath gives up a few units in the last place for speed: float
+// reciprocal square roots refined with Newton's method, multiplications by reciprocals
+// instead of divisions, Schlick's power as a product and fused dot and cross
+// products. Multiply-adds are only fused when the target has instructions
+// for them (built with -mfma or a -march that has FMA); std::fma would be a
+// slow library call otherwise.
+struct FastMath
+{
+    template <typename T>
+    static T sqrt(T x) { return std::sqrt(x); }
+
+    // An estimate of 1/sqrt(x): the SSE rsqrtss instruction, good to about
+    // 12 bits, or else the integer shift trick, good to about 5
+    static float inverse_sqrt_estimate(float x)
+    {
+#if defined(__SSE__)
+        return _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(x)));
+#else
+        std::uint32_t i;
+        std::memcpy(&i, &x, sizeof(i));
+        i = 0x5f375a86 - (i >> 1);
+        float y;
+        std::memcpy(&y, &i, sizeof(y));
+        return y;
+#endif
+    }
+
+#if defined(__SSE__)
+    static constexpr int estimate_bits = 12;
+#else
+    static constexpr int estimate_bits = 5;
+#endif
+
+    // For float, the estimate refined with Newton steps, each of which about
+    // doubles the number of correct bits, until the mantissa is covered
+    static float inverse_sqrt(float x)
+    {
+        constexpr int mantissa_bits = std::numeric_limits<float>::digits;
+        float y = inverse_sqrt_estimate(x);
+        for (int bits = estimate_bits; bits < mantissa_bits; bits *= 2)
+        {
+            y = y * (1.5f - 0.5f * x * y * y);
+        }
+        return y;
+    }
+
+    // Other types are out of the range of the float estimate, and the Newton
+    // steps double needs cost more than a square root and a division
+    template <typename T>
+    static T inverse_sqrt(T x) { return 1 / std::sqrt(x); }
+
+    template <typename T>
+    static T pow5(T x)
+    {
+        const T x2 = x * x;
+        return x2 * x2 * x;
+    }
+
+    template <typename T>
+    static T divide(T a, T b) { return a * (1 / b); }
+
+    template <typename T>
+    static Vec3<T> divide(const Vec3<T>& v, T t) { return (1 / t) * v; }
+
+    template <typename T>
+    static T multiply_add(T a, T b, T c)
+    {
+#if defined(__FP_FAST_FMA) && defined(__FP_FAST_FMAF)
+        return std::fma(a, b, c);
+#else
+        return a * b + c;
+#endif
+    }
+
+    template <typename T>
+    static T dot(const Vec3<T>& v1, const Vec3<T>& v2)
+    {
+        return multiply_add(v1.x(), v2.x(), multiply_add(v1.y(), v2.y(), v1.z() * v2.z()));
+    }
+
+    template <typename T>
+    static Vec3<T> cross(const Vec3<T>& v1, const Vec3<T>& v2)
+    {
+        return {
+            multiply_add(v1.y(), v2.z(), -v1.z() * v2.y()),
+            multiply_add(v1.z(), v2.x(), -v1.x() * v2.z()),
+            multiply_add(v1.x(), v2.y(), -v1.y() * v2.x())
+        };
+    }
+
+    template <typename T>
+    static Vec3<T> unit_vector(const Vec3<T>& v)
+    {
+        return inverse_sqrt(v.squared_length()) * v;
+    }
+};
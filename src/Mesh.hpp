@@ -0,0 +1,956 @@
+#pragma once
+
+#include "Point.hpp"
+#include "Vec.hpp"
+#include "VecMath.hpp"
+#include "Ray.hpp"
+#include "HitRecord.hpp"
+#include "Hit.hpp"
+#include "Material.hpp"
+#include "Sphere.hpp"
+#include "World.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// A read-only memory mapping of a whole file
+class MappedFile
+{
+public:
+    explicit MappedFile(const char* path)
+    {
+        int fd = open(path, O_RDONLY);
+        if (fd < 0)
+        {
+            return;
+        }
+
+        struct stat status;
+        if (fstat(fd, &status) == 0 && status.st_size > 0)
+        {
+            void* data = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED)
+            {
+                m_data = static_cast<const char*>(data);
+                m_size = status.st_size;
+            }
+        }
+        close(fd);
+    }
+
+    ~MappedFile()
+    {
+        if (m_data != nullptr)
+        {
+            munmap(const_cast<char*>(m_data), m_size);
+        }
+    }
+
+    bool valid() const { return m_data != nullptr; }
+    const char* data() const { return m_data; }
+    std::size_t size() const { return m_size; }
+
+private:
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* m_data{nullptr};
+    std::size_t m_size{0};
+};
+
+// A triangle mesh loaded from a binary little endian PLY or an OBJ file.
+//
+// PLY vertex and face data is used in place from the memory mapped file, so
+// loading costs little more than reading the header and building the BVH.
+// Only faces that are not triangles, and OBJ files, which are text, need
+// an index buffer of their own.
+//
+// Triangles are intersected with the watertight test of Woop, Benthin and
+// Wald (JCGT 2013), PACKET_SIZE triangles at a time: each BVH leaf holds up
+// to PACKET_SIZE triangles whose vertices are gathered into arrays so that
+// the compiler can vectorize the test across them.
+template <typename T, int PACKET_SIZE = 8>
+class TriangleMesh : public Hittable<T>
+{
+public:
+    static std::unique_ptr<TriangleMesh> load(
+        const char* path,
+        const Material<T>* material,
+        std::string& error)
+    {
+        std::unique_ptr<TriangleMesh> mesh{new TriangleMesh{path, material}};
+        if (!mesh->m_file.valid())
+        {
+            error = std::string{"could not map "} + path;
+            return nullptr;
+        }
+
+        const std::string name{path};
+        const bool is_obj = name.size() >= 4 &&
+            (name.compare(name.size() - 4, 4, ".obj") == 0 ||
+             name.compare(name.size() - 4, 4, ".OBJ") == 0);
+
+        if (!(is_obj ? mesh->parse_obj(error) : mesh->parse_ply(error)))
+        {
+            return nullptr;
+        }
+
+        if (mesh->m_num_triangles == 0)
+        {
+            error = std::string{"no triangles in "} + path;
+            return nullptr;
+        }
+
+        mesh->build_bvh();
+        return mesh;
+    }
+
+    // Place the mesh in the world: a point p of the model ends up at
+    // p * scale + translation
+    void set_placement(const Vec3<T>& translation, T scale)
+    {
+        m_translation = translation;
+        m_scale = scale;
+    }
+
+    // Bounds of the model before placement
+    Point3<T> lower() const { return {m_nodes[0].lower[0], m_nodes[0].lower[1], m_nodes[0].lower[2]}; }
+    Point3<T> upper() const { return {m_nodes[0].upper[0], m_nodes[0].upper[1], m_nodes[0].upper[2]}; }
+
+    std::size_t num_triangles() const { return m_num_triangles; }
+    std::size_t num_vertices() const { return m_num_vertices; }
+
+    bool hit(
+        const Ray3<Point3<T>, Vec3<T>>& ray,
+        T t_min,
+        T t_max,
+        HitRecord<T>& record) const override
+    {
+        return closest_hit_record(*this, ray, t_min, t_max, record);
+    }
+
+    // Primitives are the triangles, in file order
+    bool closest_hit(
+        const Ray3<Point3<T>, Vec3<T>>& ray,
+        T t_min,
+        T t_max,
+        PrimitiveHit<T>& hit) const
+    {
+        // Move the ray into model space. Translating and uniformly scaling
+        // origin and direction together leaves t unchanged.
+        const auto world_origin = ray.origin();
+        const auto world_direction = ray.direction();
+        const T o[3] = {
+            (world_origin.x() - m_translation.x()) / m_scale,
+            (world_origin.y() - m_translation.y()) / m_scale,
+            (world_origin.z() - m_translation.z()) / m_scale
+        };
+        const T d[3] = {
+            world_direction.x() / m_scale,
+            world_direction.y() / m_scale,
+            world_direction.z() / m_scale
+        };
+
+        // Per ray setup of the watertight test: permute the axes so that z is
+        // the dominant direction and shear the ray onto the z axis
+        int kz = 0;
+        if (fabs(d[1]) > fabs(d[kz])) kz = 1;
+        if (fabs(d[2]) > fabs(d[kz])) kz = 2;
+        int kx = (kz + 1) % 3;
+        int ky = (kx + 1) % 3;
+        if (d[kz] < 0)
+        {
+            std::swap(kx, ky);
+        }
+        const Shear shear{
+            {kx, ky, kz},
+            d[kx] / d[kz],
+            d[ky] / d[kz],
+            1 / d[kz]
+        };
+
+        const T inverse_direction[3] = {1 / d[0], 1 / d[1], 1 / d[2]};
+
+        T closest_so_far = t_max;
+        std::uint32_t closest_triangle = std::numeric_limits<std::uint32_t>::max();
+
+        std::uint32_t stack[64];
+        int stack_size = 0;
+        stack[stack_size++] = 0;
+
+        while (stack_size > 0)
+        {
+            const auto& node = m_nodes[stack[--stack_size]];
+            if (!intersect_bounds(node, o, inverse_direction, t_min, closest_so_far))
+            {
+                continue;
+            }
+
+            if (node.count > 0)
+            {
+                intersect_leaf(node, o, shear, t_min, closest_so_far, closest_triangle);
+            }
+            else
+            {
+                // Visit the child on the side the ray comes from first
+                const auto first = node.first;
+                if (d[node.axis] > 0)
+                {
+                    stack[stack_size++] = first + 1;
+                    stack[stack_size++] = first;
+                }
+                else
+                {
+                    stack[stack_size++] = first;
+                    stack[stack_size++] = first + 1;
+                }
+            }
+        }
+
+        if (closest_triangle == std::numeric_limits<std::uint32_t>::max())
+        {
+            return false;
+        }
+
+        hit = {closest_so_far, closest_triangle};
+        return true;
+    }
+
+    void set_hit_record(
+        const Ray3<Point3<T>, Vec3<T>>& ray,
+        const PrimitiveHit<T>& hit,
+        HitRecord<T>& record) const
+    {
+        std::uint32_t index[3];
+        triangle(hit.primitive, index);
+        const auto a = vertex(index[0]);
+        const auto b = vertex(index[1]);
+        const auto c = vertex(index[2]);
+
+        record.t = hit.t;
+        record.p = ray.point_at_parameter(record.t);
+
+        const auto outward_normal = unit_vector(cross(make_vec(b, a), make_vec(c, a)));
+        record.front_face = dot(ray.direction(), outward_normal) < 0;
+        record.normal = record.front_face ? outward_normal : -outward_normal;
+        record.material = m_material;
+    }
+
+    std::size_t num_primitives() const { return m_num_triangles; }
+
+private:
+    TriangleMesh(const char* path, const Material<T>* material)
+        :
+        m_file{path},
+        m_material{material}
+    {}
+
+    // Bound on the relative error of three rounded operations
+    static constexpr T rounding_bound =
+        3 * std::numeric_limits<T>::epsilon() / 2 / (1 - 3 * std::numeric_limits<T>::epsilon() / 2);
+
+    struct Shear
+    {
+        int k[3];
+        T sx, sy, sz;
+    };
+
+    struct Node
+    {
+        float lower[3];
+        float upper[3];
+        // First triangle of a leaf in m_order, or first of the two children
+        std::uint32_t first;
+        // Number of triangles of a leaf, 0 for an inner node
+        std::uint16_t count;
+        std::uint16_t axis;
+    };
+
+    Point3<T> vertex(std::uint32_t i) const
+    {
+        if (!m_vertices.empty())
+        {
+            return {m_vertices[3*i], m_vertices[3*i + 1], m_vertices[3*i + 2]};
+        }
+
+        // The file gives no alignment guarantees, so copy the coordinates out
+        const char* v = m_vertex_data + (std::size_t)i * m_vertex_stride;
+        float x, y, z;
+        memcpy(&x, v + m_vertex_offset[0], sizeof(float));
+        memcpy(&y, v + m_vertex_offset[1], sizeof(float));
+        memcpy(&z, v + m_vertex_offset[2], sizeof(float));
+        return {x, y, z};
+    }
+
+    void triangle(std::uint32_t t, std::uint32_t index[3]) const
+    {
+        if (!m_indices.empty())
+        {
+            index[0] = m_indices[3*t];
+            index[1] = m_indices[3*t + 1];
+            index[2] = m_indices[3*t + 2];
+            return;
+        }
+
+        // In place PLY face: a one byte count followed by three indices
+        memcpy(index, m_face_data + (std::size_t)t * m_face_stride + 1, 3 * sizeof(std::uint32_t));
+    }
+
+    bool intersect_bounds(
+        const Node& node,
+        const T o[3],
+        const T inverse_direction[3],
+        T t_min,
+        T t_max) const
+    {
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            // A ray parallel to the slabs, possibly in one of their planes,
+            // where the products below would be 0 * infinity
+            if (inverse_direction[axis] == std::numeric_limits<T>::infinity() ||
+                inverse_direction[axis] == -std::numeric_limits<T>::infinity())
+            {
+                if (o[axis] < node.lower[axis] || o[axis] > node.upper[axis])
+                {
+                    return false;
+                }
+                continue;
+            }
+
+            T t0 = (node.lower[axis] - o[axis]) * inverse_direction[axis];
+            T t1 = (node.upper[axis] - o[axis]) * inverse_direction[axis];
+            if (t0 > t1)
+            {
+                std::swap(t0, t1);
+            }
+            // Widen for the rounding of the slab distances, or rays through
+            // an edge or corner of the box can miss it (Pharr et al., PBRT)
+            t1 *= 1 + 2 * rounding_bound;
+            t_min = t0 > t_min ? t0 : t_min;
+            t_max = t1 < t_max ? t1 : t_max;
+            if (t_min > t_max)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void intersect_leaf(
+        const Node& node,
+        const T o[3],
+        const Shear& shear,
+        T t_min,
+        T& closest_so_far,
+        std::uint32_t& closest_triangle) const
+    {
+        // Gather the sheared vertices of the leaf's triangles, relative to
+        // the ray origin. Unused lanes stay degenerate and never hit.
+        T ax[PACKET_SIZE] = {}, ay[PACKET_SIZE] = {}, az[PACKET_SIZE] = {};
+        T bx[PACKET_SIZE] = {}, by[PACKET_SIZE] = {}, bz[PACKET_SIZE] = {};
+        T cx[PACKET_SIZE] = {}, cy[PACKET_SIZE] = {}, cz[PACKET_SIZE] = {};
+
+        for (int lane = 0; lane < node.count; ++lane)
+        {
+            std::uint32_t index[3];
+            triangle(m_order[node.first + lane], index);
+
+            T* xs[3] = {ax, bx, cx};
+            T* ys[3] = {ay, by, cy};
+            T* zs[3] = {az, bz, cz};
+            for (int corner = 0; corner < 3; ++corner)
+            {
+                const auto v = vertex(index[corner]);
+                const T p[3] = {v.x() - o[0], v.y() - o[1], v.z() - o[2]};
+                const T pz = p[shear.k[2]];
+                xs[corner][lane] = p[shear.k[0]] - shear.sx * pz;
+                ys[corner][lane] = p[shear.k[1]] - shear.sy * pz;
+                zs[corner][lane] = shear.sz * pz;
+            }
+        }
+
+        // Edge functions of every lane. The loops over the whole packet are
+        // kept rolled so that they reach the loop vectorizer; fully unrolled,
+        // the double packets are left scalar.
+        T u[PACKET_SIZE], v[PACKET_SIZE], w[PACKET_SIZE];
+#pragma GCC unroll 1
+        for (int lane = 0; lane < PACKET_SIZE; ++lane)
+        {
+            u[lane] = cx[lane] * by[lane] - cy[lane] * bx[lane];
+            v[lane] = ax[lane] * cy[lane] - ay[lane] * cx[lane];
+            w[lane] = bx[lane] * ay[lane] - by[lane] * ax[lane];
+        }
+
+        if constexpr (std::is_same<T, float>::value)
+        {
+            // Edges through the ray need double precision to decide which
+            // triangle they belong to. Rare, so done lane by lane after the
+            // packet.
+            for (int lane = 0; lane < node.count; ++lane)
+            {
+                if (u[lane] == 0 || v[lane] == 0 || w[lane] == 0)
+                {
+                    u[lane] = (float)((double)cx[lane] * by[lane] - (double)cy[lane] * bx[lane]);
+                    v[lane] = (float)((double)ax[lane] * cy[lane] - (double)ay[lane] * cx[lane]);
+                    w[lane] = (float)((double)bx[lane] * ay[lane] - (double)by[lane] * ax[lane]);
+                }
+            }
+        }
+
+        // Distances, with lanes that miss set to infinity. Bitwise
+        // operators instead of && and || keep the loop free of branches, so
+        // it is vectorized.
+        T t[PACKET_SIZE];
+#pragma GCC unroll 1
+        for (int lane = 0; lane < PACKET_SIZE; ++lane)
+        {
+            const T determinant = u[lane] + v[lane] + w[lane];
+            const T scaled_t = u[lane] * az[lane] + v[lane] * bz[lane] + w[lane] * cz[lane];
+            const T lane_t = scaled_t / determinant;
+
+            const bool inside =
+                ((u[lane] >= 0) & (v[lane] >= 0) & (w[lane] >= 0)) |
+                ((u[lane] <= 0) & (v[lane] <= 0) & (w[lane] <= 0));
+            const bool valid = inside & (determinant != 0) &
+                (lane_t > t_min) & (lane_t < closest_so_far);
+            t[lane] = valid ? lane_t : std::numeric_limits<T>::infinity();
+        }
+
+        for (int lane = 0; lane < node.count; ++lane)
+        {
+            if (t[lane] < closest_so_far)
+            {
+                closest_so_far = t[lane];
+                closest_triangle = m_order[node.first + lane];
+            }
+        }
+    }
+
+    // Build a BVH by splitting triangle centroids at the median of the
+    // longest axis, down to leaves of at most PACKET_SIZE triangles
+    void build_bvh()
+    {
+        m_order.resize(m_num_triangles);
+        std::vector<float> centroids(3 * m_num_triangles);
+        std::vector<float> lower(3 * m_num_triangles);
+        std::vector<float> upper(3 * m_num_triangles);
+        for (std::uint32_t t = 0; t < m_num_triangles; ++t)
+        {
+            m_order[t] = t;
+            std::uint32_t index[3];
+            triangle(t, index);
+            const Point3<T> v[3] = {vertex(index[0]), vertex(index[1]), vertex(index[2])};
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                const T c[3] = {
+                    axis == 0 ? v[0].x() : axis == 1 ? v[0].y() : v[0].z(),
+                    axis == 0 ? v[1].x() : axis == 1 ? v[1].y() : v[1].z(),
+                    axis == 0 ? v[2].x() : axis == 1 ? v[2].y() : v[2].z()
+                };
+                lower[3*t + axis] = std::min({c[0], c[1], c[2]});
+                upper[3*t + axis] = std::max({c[0], c[1], c[2]});
+                centroids[3*t + axis] = (lower[3*t + axis] + upper[3*t + axis]) / 2;
+            }
+        }
+
+        m_nodes.reserve(2 * (m_num_triangles / PACKET_SIZE + 1));
+        m_nodes.push_back({});
+
+        struct Range
+        {
+            std::uint32_t node;
+            std::uint32_t begin;
+            std::uint32_t end;
+        };
+        std::vector<Range> ranges{{0, 0, (std::uint32_t)m_num_triangles}};
+
+        while (!ranges.empty())
+        {
+            const auto range = ranges.back();
+            ranges.pop_back();
+
+            Node node{};
+            float centroid_lower[3], centroid_upper[3];
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                node.lower[axis] = centroid_lower[axis] = std::numeric_limits<float>::max();
+                node.upper[axis] = centroid_upper[axis] = std::numeric_limits<float>::lowest();
+            }
+            for (auto i = range.begin; i < range.end; ++i)
+            {
+                const auto t = m_order[i];
+                for (int axis = 0; axis < 3; ++axis)
+                {
+                    node.lower[axis] = std::min(node.lower[axis], lower[3*t + axis]);
+                    node.upper[axis] = std::max(node.upper[axis], upper[3*t + axis]);
+                    centroid_lower[axis] = std::min(centroid_lower[axis], centroids[3*t + axis]);
+                    centroid_upper[axis] = std::max(centroid_upper[axis], centroids[3*t + axis]);
+                }
+            }
+
+            const auto count = range.end - range.begin;
+            if (count <= PACKET_SIZE)
+            {
+                node.first = range.begin;
+                node.count = count;
+                m_nodes[range.node] = node;
+                continue;
+            }
+
+            int axis = 0;
+            for (int a = 1; a < 3; ++a)
+            {
+                if (centroid_upper[a] - centroid_lower[a] > centroid_upper[axis] - centroid_lower[axis])
+                {
+                    axis = a;
+                }
+            }
+
+            const auto middle = range.begin + count / 2;
+            std::nth_element(
+                m_order.begin() + range.begin,
+                m_order.begin() + middle,
+                m_order.begin() + range.end,
+                [&](std::uint32_t t1, std::uint32_t t2) {
+                    return centroids[3*t1 + axis] < centroids[3*t2 + axis];
+                });
+
+            node.first = m_nodes.size();
+            node.count = 0;
+            node.axis = axis;
+            m_nodes[range.node] = node;
+
+            m_nodes.push_back({});
+            m_nodes.push_back({});
+            ranges.push_back({node.first, range.begin, middle});
+            ranges.push_back({node.first + 1, middle, range.end});
+        }
+    }
+
+    static bool next_line(const char*& p, const char* end, const char*& line, const char*& line_end)
+    {
+        if (p >= end)
+        {
+            return false;
+        }
+        line = p;
+        while (p < end && *p != '\n')
+        {
+            ++p;
+        }
+        line_end = p;
+        if (line_end > line && line_end[-1] == '\r')
+        {
+            --line_end;
+        }
+        if (p < end)
+        {
+            ++p;
+        }
+        return true;
+    }
+
+    static int ply_type_size(const std::string& type)
+    {
+        if (type == "char" || type == "uchar" || type == "int8" || type == "uint8") return 1;
+        if (type == "short" || type == "ushort" || type == "int16" || type == "uint16") return 2;
+        if (type == "int" || type == "uint" || type == "int32" || type == "uint32" ||
+            type == "float" || type == "float32") return 4;
+        if (type == "double" || type == "float64") return 8;
+        return 0;
+    }
+
+    static bool is_ply_int32(const std::string& type)
+    {
+        return type == "int" || type == "uint" || type == "int32" || type == "uint32";
+    }
+
+    bool parse_ply(std::string& error)
+    {
+        const char* p = m_file.data();
+        const char* end = p + m_file.size();
+        const char* line;
+        const char* line_end;
+
+        if (!next_line(p, end, line, line_end) || std::string(line, line_end) != "ply")
+        {
+            error = "not a PLY file";
+            return false;
+        }
+
+        struct Element
+        {
+            std::string name;
+            std::size_t count{0};
+            std::size_t stride{0};
+            bool has_list{false};
+            std::string list_count_type;
+            std::string list_index_type;
+        };
+        std::vector<Element> elements;
+        int vertex_offset[3] = {-1, -1, -1};
+        bool binary_little_endian = false;
+
+        while (next_line(p, end, line, line_end))
+        {
+            std::istringstream words{std::string(line, line_end)};
+            std::string keyword;
+            words >> keyword;
+
+            if (keyword == "format")
+            {
+                std::string format;
+                words >> format;
+                binary_little_endian = format == "binary_little_endian";
+            }
+            else if (keyword == "element")
+            {
+                Element element;
+                words >> element.name >> element.count;
+                elements.push_back(element);
+            }
+            else if (keyword == "property" && !elements.empty())
+            {
+                auto& element = elements.back();
+                std::string type;
+                words >> type;
+                if (type == "list")
+                {
+                    element.has_list = true;
+                    words >> element.list_count_type >> element.list_index_type;
+                    continue;
+                }
+
+                std::string name;
+                words >> name;
+                const int size = ply_type_size(type);
+                if (size == 0)
+                {
+                    error = "unknown PLY type " + type;
+                    return false;
+                }
+
+                if (element.name == "vertex" && (name == "x" || name == "y" || name == "z"))
+                {
+                    if (type != "float" && type != "float32")
+                    {
+                        error = "PLY vertex positions must be float";
+                        return false;
+                    }
+                    vertex_offset[name[0] - 'x'] = element.stride;
+                }
+                element.stride += size;
+            }
+            else if (keyword == "end_header")
+            {
+                break;
+            }
+        }
+
+        if (!binary_little_endian)
+        {
+            error = "only binary little endian PLY files are supported";
+            return false;
+        }
+
+        // Whether count elements of the given stride fit in what is left of
+        // the file. Counts come from the header, so the size is not computed
+        // as a product that could overflow.
+        const char* data = p;
+        auto fits = [&data, end](const Element& element) {
+            return element.stride == 0 ||
+                element.count <= (std::size_t)(end - data) / element.stride;
+        };
+
+        for (const auto& element : elements)
+        {
+            if (element.name == "vertex")
+            {
+                if (vertex_offset[0] < 0 || vertex_offset[1] < 0 || vertex_offset[2] < 0 ||
+                    element.has_list)
+                {
+                    error = "PLY vertices need float x, y and z";
+                    return false;
+                }
+                if (!fits(element))
+                {
+                    error = "PLY file is truncated";
+                    return false;
+                }
+                m_vertex_data = data;
+                m_vertex_stride = element.stride;
+                std::copy(vertex_offset, vertex_offset + 3, m_vertex_offset);
+                m_num_vertices = element.count;
+                data += element.count * element.stride;
+            }
+            else if (element.name == "face")
+            {
+                if (!element.has_list ||
+                    ply_type_size(element.list_count_type) != 1 ||
+                    !is_ply_int32(element.list_index_type) ||
+                    element.stride != 0)
+                {
+                    error = "PLY faces must be a list of 32 bit indices with an 8 bit count";
+                    return false;
+                }
+                if (!parse_ply_faces(data, end, element.count, error))
+                {
+                    return false;
+                }
+            }
+            else if (!element.has_list)
+            {
+                if (!fits(element))
+                {
+                    error = "PLY file is truncated";
+                    return false;
+                }
+                data += element.count * element.stride;
+            }
+            else
+            {
+                // The size of other list elements is unknown without parsing
+                // them, and nothing after them is needed
+                break;
+            }
+        }
+
+        if (m_vertex_data == nullptr)
+        {
+            error = "PLY file has no vertices";
+            return false;
+        }
+
+        return check_indices(error);
+    }
+
+    // Use the faces in place if they are all triangles, otherwise triangulate
+    // them as fans into an index buffer
+    bool parse_ply_faces(const char*& data, const char* end, std::size_t count, std::string& error)
+    {
+        const char* face = data;
+        bool all_triangles = true;
+        std::size_t num_triangles = 0;
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            if (face >= end)
+            {
+                error = "PLY file is truncated";
+                return false;
+            }
+            const auto n = (unsigned char)*face;
+            if ((std::size_t)(end - face) < 1 + 4 * (std::size_t)n)
+            {
+                error = "PLY file is truncated";
+                return false;
+            }
+            all_triangles = all_triangles && n == 3;
+            num_triangles += n >= 3 ? n - 2 : 0;
+            face += 1 + 4 * n;
+        }
+
+        if (all_triangles)
+        {
+            m_face_data = data;
+            m_face_stride = 1 + 3 * sizeof(std::uint32_t);
+        }
+        else
+        {
+            m_indices.reserve(3 * num_triangles);
+            face = data;
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                const auto n = (unsigned char)*face;
+                if (n < 3)
+                {
+                    // Points and edges have no triangles, and a face without
+                    // indices has no first index to read
+                    face += 1 + 4 * n;
+                    continue;
+                }
+
+                std::uint32_t first, previous, current;
+                memcpy(&first, face + 1, 4);
+                for (unsigned corner = 1; corner < n; ++corner)
+                {
+                    memcpy(&current, face + 1 + 4 * corner, 4);
+                    if (corner >= 2)
+                    {
+                        m_indices.insert(m_indices.end(), {first, previous, current});
+                    }
+                    previous = current;
+                }
+                face += 1 + 4 * n;
+            }
+        }
+
+        m_num_triangles = num_triangles;
+        data = face;
+        return true;
+    }
+
+    bool parse_obj(std::string& error)
+    {
+        const char* p = m_file.data();
+        const char* end = p + m_file.size();
+        const char* line;
+        const char* line_end;
+
+        auto skip_spaces = [](const char*& q, const char* e) {
+            while (q < e && (*q == ' ' || *q == '\t'))
+            {
+                ++q;
+            }
+        };
+
+        std::vector<std::uint32_t> face;
+        while (next_line(p, end, line, line_end))
+        {
+            const char* q = line;
+            skip_spaces(q, line_end);
+            if (line_end - q < 2 || q[1] != ' ')
+            {
+                continue;
+            }
+
+            if (q[0] == 'v')
+            {
+                q += 2;
+                for (int axis = 0; axis < 3; ++axis)
+                {
+                    skip_spaces(q, line_end);
+                    float value;
+                    auto result = std::from_chars(q, line_end, value);
+                    if (result.ec != std::errc{})
+                    {
+                        error = "bad OBJ vertex: " + std::string(line, line_end);
+                        return false;
+                    }
+                    m_vertices.push_back(value);
+                    q = result.ptr;
+                }
+            }
+            else if (q[0] == 'f')
+            {
+                q += 2;
+                face.clear();
+                for (;;)
+                {
+                    skip_spaces(q, line_end);
+                    if (q >= line_end)
+                    {
+                        break;
+                    }
+                    long index;
+                    auto result = std::from_chars(q, line_end, index);
+                    if (result.ec != std::errc{} || index == 0)
+                    {
+                        error = "bad OBJ face: " + std::string(line, line_end);
+                        return false;
+                    }
+                    // Negative indices count back from the last vertex
+                    const long num_vertices = m_vertices.size() / 3;
+                    face.push_back(index > 0 ? index - 1 : num_vertices + index);
+                    q = result.ptr;
+                    // Skip texture and normal indices
+                    while (q < line_end && *q != ' ' && *q != '\t')
+                    {
+                        ++q;
+                    }
+                }
+
+                for (std::size_t corner = 2; corner < face.size(); ++corner)
+                {
+                    m_indices.insert(m_indices.end(), {face[0], face[corner - 1], face[corner]});
+                }
+            }
+        }
+
+        m_num_vertices = m_vertices.size() / 3;
+        m_num_triangles = m_indices.size() / 3;
+        return check_indices(error);
+    }
+
+    bool check_indices(std::string& error) const
+    {
+        for (std::size_t t = 0; t < m_num_triangles; ++t)
+        {
+            std::uint32_t index[3];
+            triangle(t, index);
+            if (index[0] >= m_num_vertices || index[1] >= m_num_vertices || index[2] >= m_num_vertices)
+            {
+                error = "vertex index out of range in triangle " + std::to_string(t);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    MappedFile m_file;
+    const Material<T>* m_material;
+
+    Vec3<T> m_translation{0, 0, 0};
+    T m_scale{1};
+
+    // Vertices either in the mapped file, x, y and z at the given offsets
+    // within each vertex, or in m_vertices
+    const char* m_vertex_data{nullptr};
+    std::size_t m_vertex_stride{0};
+    int m_vertex_offset[3]{};
+    std::vector<float> m_vertices;
+    std::size_t m_num_vertices{0};
+
+    // Triangles either in the mapped file, or three indices each in m_indices
+    const char* m_face_data{nullptr};
+    std::size_t m_face_stride{0};
+    std::vector<std::uint32_t> m_indices;
+    std::size_t m_num_triangles{0};
+
+    std::vector<Node> m_nodes;
+    std::vector<std::uint32_t> m_order;
+};
+
+// A mesh standing on a ground sphere. The mesh is shared, so that every NUMA
+// node's replica of the scene traces the same mapped file and BVH.
+template <typename T, typename MESH>
+class MeshScene
+{
+public:
+    using SphereContainer = std::vector<Sphere3<T>>;
+    using Accelerator = HitGroup<T, World<T, const SphereContainer>, MESH>;
+
+    explicit MeshScene(const MESH& mesh)
+        :
+        m_spheres{{Point3<T>{0, -1000, 0}, 1000, &m_material_ground}},
+        m_world{m_spheres},
+        m_accelerator{m_world, mesh}
+    {}
+
+    const Accelerator& accelerator() const { return m_accelerator; }
+
+private:
+    // The spheres point to the material and the group to the world
+    MeshScene(const MeshScene&) = delete;
+    MeshScene(MeshScene&&) = delete;
+    MeshScene& operator=(const MeshScene&) = delete;
+    MeshScene& operator=(MeshScene&&) = delete;
+
+    Lambertian<T> m_material_ground{Vec3<T>{0.5, 0.5, 0.5}};
+    SphereContainer m_spheres;
+    World<T, const SphereContainer> m_world;
+    Accelerator m_accelerator;
+};
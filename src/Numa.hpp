@@ -0,0 +1,150 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+
+// A NUMA node and the CPUs that belong to it
+struct NumaNode
+{
+    int id;
+    std::vector<int> cpus;
+};
+
+// Parse a Linux CPU or node list such as "0-3,8-11"
+inline std::vector<int> parse_cpu_list(const std::string& list)
+{
+    std::vector<int> cpus;
+    const char* p = list.c_str();
+    while (*p != '\0' && *p != '\n')
+    {
+        char* end;
+        const long first = strtol(p, &end, 10);
+        if (end == p)
+        {
+            break;
+        }
+
+        long last = first;
+        p = end;
+        if (*p == '-')
+        {
+            last = strtol(p + 1, &end, 10);
+            p = end;
+        }
+
+        for (long cpu = first; cpu <= last; ++cpu)
+        {
+            cpus.push_back((int)cpu);
+        }
+
+        if (*p == ',')
+        {
+            ++p;
+        }
+    }
+    return cpus;
+}
+
+// The first line of a small text file, empty if it cannot be read
+inline std::string read_first_line(const char* path)
+{
+    FILE* file = fopen(path, "r");
+    if (file == nullptr)
+    {
+        return {};
+    }
+
+    char line[1024] = {};
+    if (fgets(line, sizeof(line), file) == nullptr)
+    {
+        line[0] = '\0';
+    }
+    fclose(file);
+    return line;
+}
+
+// The CPUs the process may run on, as restricted by taskset or a cpuset
+inline std::vector<int> allowed_cpus()
+{
+    std::vector<int> cpus;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0)
+    {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+        {
+            if (CPU_ISSET(cpu, &set))
+            {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+
+    if (cpus.empty())
+    {
+        const unsigned num_cpus = std::thread::hardware_concurrency();
+        for (unsigned cpu = 0; cpu < (num_cpus == 0 ? 1 : num_cpus); ++cpu)
+        {
+            cpus.push_back((int)cpu);
+        }
+    }
+    return cpus;
+}
+
+// The number of threads to run by default: one per allowed CPU
+inline unsigned num_allowed_cpus()
+{
+    return (unsigned)allowed_cpus().size();
+}
+
+// Read the NUMA topology from /sys. Node ids may have gaps, so the nodes are
+// taken from the list of online nodes rather than counted up from 0. Only
+// the CPUs the process may run on are kept, and nodes left without any are
+// dropped, so that workers are never pinned outside the affinity mask.
+// Machines without NUMA information are treated as a single node holding
+// every allowed CPU.
+inline std::vector<NumaNode> numa_topology()
+{
+    const auto allowed = allowed_cpus();
+    std::vector<NumaNode> nodes;
+
+    for (int id : parse_cpu_list(read_first_line("/sys/devices/system/node/online")))
+    {
+        char path[64];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", id);
+        const auto node_cpus = parse_cpu_list(read_first_line(path));
+
+        std::vector<int> cpus;
+        std::set_intersection(
+            node_cpus.begin(), node_cpus.end(), allowed.begin(), allowed.end(),
+            std::back_inserter(cpus));
+        if (!cpus.empty())
+        {
+            nodes.push_back({id, std::move(cpus)});
+        }
+    }
+
+    if (nodes.empty())
+    {
+        nodes.push_back({0, allowed});
+    }
+
+    return nodes;
+}
+
+// Restrict the calling thread to a single CPU
+inline bool pin_current_thread(int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
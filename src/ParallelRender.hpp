@@ -0,0 +1,256 @@
+#pragma once
+
+#include "Camera.hpp"
+#include "Scene.hpp"
+#include "Render.hpp"
+#include "Random.hpp"
+#include "Numa.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+struct ParallelRenderOptions
+{
+    unsigned num_threads{num_allowed_cpus()};
+
+    // Pin workers to CPUs, give every NUMA node its own copy of the scene and
+    // let each node render the part of the image whose pages it first touches
+    bool numa_aware{true};
+
+    int tile_size{16};
+
+    // Give every sample its own random stream so that the image does not
+    // depend on the number of threads, the tile size or the tile order
+    bool deterministic{false};
+};
+
+// The pixels of a tile: columns x_begin to x_end and rows y_begin to y_end,
+// the ends excluded
+struct TileBounds
+{
+    int x_begin;
+    int y_begin;
+    int x_end;
+    int y_end;
+};
+
+// Square tiles covering a width x height image. Images are stored column by
+// column, so tiles are numbered column major: consecutive tiles are next to
+// each other in memory.
+class TileGrid
+{
+public:
+    TileGrid(int width, int height, int tile_size)
+        :
+        m_width{width},
+        m_height{height},
+        m_tile_size{tile_size},
+        m_tiles_x{(width + tile_size - 1) / tile_size},
+        m_tiles_y{(height + tile_size - 1) / tile_size}
+    {}
+
+    int num_tiles() const { return m_tiles_x * m_tiles_y; }
+
+    TileBounds bounds(int tile) const
+    {
+        const int x_begin = (tile / m_tiles_y) * m_tile_size;
+        const int y_begin = (tile % m_tiles_y) * m_tile_size;
+        return {
+            x_begin,
+            y_begin,
+            std::min(x_begin + m_tile_size, m_width),
+            std::min(y_begin + m_tile_size, m_height)
+        };
+    }
+
+private:
+    int m_width;
+    int m_height;
+    int m_tile_size;
+    int m_tiles_x;
+    int m_tiles_y;
+};
+
+// Replicas of a scene, one per NUMA node the workers of options run on.
+// make_scene returns a std::unique_ptr to a scene; the replica of a node is
+// built by the first worker of the node that needs it, so its memory is local
+// to the node. Replicas are kept until they are destroyed, so passing them to
+// several calls of for_each_tile_parallel with the same options builds the
+// scene once per node for all of them.
+template <typename MakeScene>
+class SceneReplicas
+{
+public:
+    using SceneType = typename decltype(std::declval<MakeScene&>()())::element_type;
+
+    SceneReplicas(MakeScene make_scene, const ParallelRenderOptions& options)
+        :
+        m_make_scene{std::move(make_scene)},
+        m_nodes{options.numa_aware ?
+            numa_topology() : std::vector<NumaNode>{{0, {}}}},
+        m_num_nodes{std::min<int>(m_nodes.size(), std::max(1u, options.num_threads))},
+        m_replicas{new Replica[m_num_nodes]}
+    {}
+
+    int num_nodes() const { return m_num_nodes; }
+    const NumaNode& node(int node) const { return m_nodes[node]; }
+
+    const SceneType& get(int node)
+    {
+        auto& replica = m_replicas[node];
+        std::call_once(replica.created, [&] {
+            replica.scene = m_make_scene();
+        });
+        return *replica.scene;
+    }
+
+private:
+    struct Replica
+    {
+        std::once_flag created;
+        std::unique_ptr<SceneType> scene;
+    };
+
+    MakeScene m_make_scene;
+    std::vector<NumaNode> m_nodes;
+    int m_num_nodes;
+    std::unique_ptr<Replica[]> m_replicas;
+};
+
+// Call process_tile(tile, scene) for every tile from 0 to num_tiles - 1 on
+// a pool of threads, where scene is the replica of the NUMA node the tile is
+// processed on.
+//
+// Every node gets a contiguous range of tiles. When tiles are numbered in
+// memory order, the node touches the pages of its part of the output first,
+// so they are placed on the node. Nodes that run out of work take tiles from
+// the other nodes.
+template <typename MakeScene, typename ProcessTile>
+void for_each_tile_parallel(
+    int num_tiles,
+    SceneReplicas<MakeScene>& replicas,
+    ProcessTile process_tile,
+    const ParallelRenderOptions& options = {})
+{
+    const unsigned num_threads = std::max(1u, options.num_threads);
+    const int num_nodes = replicas.num_nodes();
+
+    struct NodeState
+    {
+        std::atomic<int> next_tile{0};
+        int end_tile{0};
+    };
+
+    std::unique_ptr<NodeState[]> node_states{new NodeState[num_nodes]};
+    for (int node = 0; node < num_nodes; ++node)
+    {
+        node_states[node].next_tile = node * num_tiles / num_nodes;
+        node_states[node].end_tile = (node + 1) * num_tiles / num_nodes;
+    }
+
+    auto work = [&](unsigned thread) {
+        const int node = thread % num_nodes;
+        const auto& cpus = replicas.node(node).cpus;
+        if (options.numa_aware && !cpus.empty())
+        {
+            pin_current_thread(cpus[(thread / num_nodes) % cpus.size()]);
+        }
+
+        const auto& scene = replicas.get(node);
+        for (int i = 0; i < num_nodes; ++i)
+        {
+            auto& tiles = node_states[(node + i) % num_nodes];
+            for (int tile = tiles.next_tile++; tile < tiles.end_tile; tile = tiles.next_tile++)
+            {
+                process_tile(tile, scene);
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned thread = 0; thread < num_threads; ++thread)
+    {
+        threads.emplace_back(work, thread);
+    }
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+}
+
+// Like above, with replicas built by make_scene for this call only
+template <typename MakeScene, typename ProcessTile,
+          typename = std::enable_if_t<std::is_invocable<MakeScene>::value>>
+void for_each_tile_parallel(
+    int num_tiles,
+    MakeScene make_scene,
+    ProcessTile process_tile,
+    const ParallelRenderOptions& options = {})
+{
+    SceneReplicas<MakeScene> replicas{std::move(make_scene), options};
+    for_each_tile_parallel(num_tiles, replicas, process_tile, options);
+}
+
+// Render a scene with a pool of threads working on square tiles. make_scene
+// returns a std::unique_ptr to a scene with an accelerator() to trace rays
+// against; it is called once per NUMA node. max_depth is an int or a
+// FixedDepth. The framebuffer must not have been written before, so that
+// its pages are first touched (and therefore placed) by the node that
+// renders them.
+template <typename T, typename Image, typename MakeScene, typename Depth,
+          typename = std::enable_if_t<std::is_invocable<MakeScene>::value>>
+void generate_image_parallel(
+    Image& image,
+    MakeScene make_scene,
+    const Camera<T>& camera,
+    int num_samples,
+    Depth max_depth,
+    unsigned seed,
+    const ParallelRenderOptions& options = {})
+{
+    const TileGrid tiles{(int)image.width, (int)image.height, options.tile_size};
+
+    using SceneType = typename decltype(make_scene())::element_type;
+    auto render_tile = [&](int tile, const SceneType& scene) {
+        const auto bounds = tiles.bounds(tile);
+        Rng rng{seed ^ (unsigned)(tile * 2654435761u)};
+        for (int x = bounds.x_begin; x < bounds.x_end; ++x)
+        {
+            for (int y = bounds.y_begin; y < bounds.y_end; ++y)
+            {
+                image[x][y] = to_pixel(options.deterministic ?
+                    sample_pixel_deterministic<T>(
+                        x, y, image.width, image.height,
+                        scene.accelerator(), camera, num_samples, max_depth, seed) :
+                    sample_pixel<T>(
+                        x, y, image.width, image.height,
+                        scene.accelerator(), camera, num_samples, max_depth, rng));
+            }
+        }
+    };
+
+    for_each_tile_parallel(tiles.num_tiles(), make_scene, render_tile, options);
+}
+
+// Render the scene generated from scene_seed
+template <typename T, typename Image>
+void generate_image_parallel(
+    Image& image,
+    unsigned scene_seed,
+    const Camera<T>& camera,
+    int num_samples,
+    int max_depth,
+    unsigned seed,
+    const ParallelRenderOptions& options = {})
+{
+    generate_image_parallel<T>(
+        image,
+        [scene_seed] { return std::make_unique<const Scene<T>>(scene_seed); },
+        camera, num_samples, max_depth, seed, options);
+}
@@ -0,0 +1,200 @@
+#pragma once
+
+#include "Color.hpp"
+#include "Camera.hpp"
+#include "Image.hpp"
+#include "Scene.hpp"
+#include "Render.hpp"
+#include "Ppm.hpp"
+#include "TaskGraph.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+template <typename T>
+struct FrameDescription
+{
+    unsigned scene_seed;
+    Camera<T> camera;
+    std::string path;
+};
+
+struct PipelineOptions
+{
+    int width{400};
+    int height{225};
+    int num_samples_per_pixel{100};
+    int max_depth{50};
+
+    // Frame f samples with the seed (f << 32) ^ seed, so the noise of every
+    // frame is different but a sequence is reproducible
+    std::uint64_t seed{0};
+
+    // Frames are rendered and encoded in bands of this many rows
+    int band_height{8};
+};
+
+// Render a sequence of frames as one task graph, so that building the scene
+// of a later frame and encoding and writing an earlier frame overlap with
+// rendering the current one. Each band of rows is encoded as soon as it has
+// been rendered. Scenes shared by several frames are built once, and freed
+// once the last frame using them has been rendered. Renders of earlier
+// frames run first, so frames finish roughly in order.
+//
+// The tasks are added to graph, which has been run when this returns, so its
+// stage timings show how the stages overlapped. Returns false if a frame
+// could not be written.
+template <typename T>
+bool render_sequence(
+    const std::vector<FrameDescription<T>>& frames,
+    const PipelineOptions& options,
+    TaskGraph& graph)
+{
+    // Renders of frame f run with priority -f. A scene is built with the
+    // priority of the frame before the first one that uses it, so it is built
+    // while that frame renders. Finishing frames comes before rendering, so
+    // memory is released early.
+    constexpr int finish_priority = 1;
+
+    struct SceneState
+    {
+        std::unique_ptr<const Scene<T>> scene;
+        TaskGraph::TaskId build;
+        std::vector<TaskGraph::TaskId> renders;
+    };
+
+    struct FrameState
+    {
+        std::unique_ptr<MappedImage<Color<int>>> image;
+        std::vector<std::string> bands;
+    };
+
+    std::map<unsigned, SceneState> scenes;
+    std::vector<FrameState> frame_states(frames.size());
+    std::atomic<bool> written{true};
+
+    const int width = options.width;
+    const int height = options.height;
+    const int band_height = options.band_height;
+    const int num_bands = (height + band_height - 1) / band_height;
+
+    for (int f = 0; f < (int)frames.size(); ++f)
+    {
+        const auto& frame = frames[f];
+        if (scenes.count(frame.scene_seed) != 0)
+        {
+            continue;
+        }
+
+        auto& scene_state = scenes[frame.scene_seed];
+        const auto scene_seed = frame.scene_seed;
+        scene_state.build = graph.add(
+            "scene " + std::to_string(scene_seed) + " build",
+            [&scene_state, scene_seed] {
+                scene_state.scene = std::make_unique<const Scene<T>>(scene_seed);
+            },
+            1 - f);
+    }
+
+    for (int f = 0; f < (int)frames.size(); ++f)
+    {
+        const auto& frame = frames[f];
+        auto& frame_state = frame_states[f];
+        auto& scene_state = scenes[frame.scene_seed];
+        const auto name = "frame " + std::to_string(f);
+        const auto seed = ((std::uint64_t)f << 32) ^ options.seed;
+
+        frame_state.image = std::make_unique<MappedImage<Color<int>>>(width, height);
+        frame_state.bands.resize(num_bands);
+
+        const auto write = graph.add(
+            name + " write",
+            [&frame_state, &frame, &written, width, height] {
+                FILE* file = fopen(frame.path.c_str(), "w");
+                if (file == nullptr)
+                {
+                    fprintf(stderr, "Could not open %s\n", frame.path.c_str());
+                    written = false;
+                }
+                else
+                {
+                    bool ok = fprintf(file, "P3\n%d %d\n255\n", width, height) > 0;
+                    for (auto& band : frame_state.bands)
+                    {
+                        ok = ok && fwrite(band.data(), 1, band.size(), file) == band.size();
+                        band = {};
+                    }
+                    ok = fclose(file) == 0 && ok;
+                    if (!ok)
+                    {
+                        fprintf(stderr, "Could not write %s\n", frame.path.c_str());
+                        written = false;
+                    }
+                }
+                frame_state.image.reset();
+            },
+            finish_priority);
+
+        // Bands are numbered from the top of the image, the order in which
+        // they are written
+        for (int band = 0; band < num_bands; ++band)
+        {
+            const int y_end = height - band * band_height;
+            const int y_begin = std::max(0, y_end - band_height);
+
+            const auto render = graph.add(
+                name + " render",
+                [&frame_state, &scene_state, &frame, &options, seed, y_begin, y_end] {
+                    auto& image = *frame_state.image;
+                    for (int y = y_begin; y < y_end; ++y)
+                    {
+                        for (int x = 0; x < image.width; ++x)
+                        {
+                            image[x][y] = to_pixel(sample_pixel_deterministic<T>(
+                                x, y, image.width, image.height,
+                                scene_state.scene->accelerator(), frame.camera,
+                                options.num_samples_per_pixel, options.max_depth,
+                                seed));
+                        }
+                    }
+                },
+                -f);
+
+            const auto encode = graph.add(
+                name + " encode",
+                [&frame_state, band, y_begin, y_end] {
+                    encode_ppm_rows(*frame_state.image, y_begin, y_end,
+                                    frame_state.bands[band]);
+                },
+                finish_priority);
+
+            graph.add_dependency(scene_state.build, render);
+            graph.add_dependency(render, encode);
+            graph.add_dependency(encode, write);
+            scene_state.renders.push_back(render);
+        }
+    }
+
+    for (auto& entry : scenes)
+    {
+        auto& scene_state = entry.second;
+        const auto release = graph.add(
+            "scene " + std::to_string(entry.first) + " release",
+            [&scene_state] { scene_state.scene.reset(); },
+            finish_priority);
+        for (auto render : scene_state.renders)
+        {
+            graph.add_dependency(render, release);
+        }
+    }
+
+    graph.run();
+    return written;
+}
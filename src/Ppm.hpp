@@ -0,0 +1,84 @@
+#pragma once
+
+#include "Color.hpp"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+template <typename Image>
+void print_ppm_image(const Image& image, FILE* file = stdout)
+{
+    // Print the image header first
+    fprintf(file, "P3\n");
+    fprintf(file, "%d %d\n", image.width, image.height);
+    fprintf(file, "255\n");
+
+    for (int y = image.height-1; y >= 0; --y)
+    {
+        for (int x = 0; x < image.width; ++x)
+        {
+            auto pixel = image[x][y];
+            fprintf(file, "%d %d %d\n", pixel.r(), pixel.g(), pixel.b());
+        }
+    }
+}
+
+// Append the pixels of rows [y_begin, y_end) to text in the format of
+// print_ppm_image, top row first
+template <typename Image>
+void encode_ppm_rows(const Image& image, int y_begin, int y_end, std::string& text)
+{
+    char pixel_text[32];
+    for (int y = y_end-1; y >= y_begin; --y)
+    {
+        for (int x = 0; x < image.width; ++x)
+        {
+            auto pixel = image[x][y];
+            snprintf(pixel_text, sizeof(pixel_text), "%d %d %d\n",
+                     pixel.r(), pixel.g(), pixel.b());
+            text += pixel_text;
+        }
+    }
+}
+
+// A PPM image as read from a file, pixels stored in file order (top row
+// first)
+struct PpmImage
+{
+    int width{0};
+    int height{0};
+    std::vector<Color<int>> pixels;
+};
+
+// Read a plain (P3) PPM image as written by print_ppm_image
+inline bool read_ppm_image(const char* path, PpmImage& image)
+{
+    FILE* file = fopen(path, "r");
+    if (file == nullptr)
+    {
+        return false;
+    }
+
+    int max_value;
+    bool ok = fscanf(file, " P3 %d %d %d", &image.width, &image.height, &max_value) == 3 &&
+        image.width > 0 && image.height > 0;
+
+    if (ok)
+    {
+        image.pixels.resize(image.width * image.height);
+        for (auto& pixel : image.pixels)
+        {
+            int r, g, b;
+            if (fscanf(file, "%d %d %d", &r, &g, &b) != 3)
+            {
+                ok = false;
+                break;
+            }
+            pixel = {r, g, b};
+        }
+    }
+
+    fclose(file);
+    return ok;
+}
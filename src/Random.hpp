@@ -1,16 +1,69 @@
 #pragma once
 
+#include <cstdint>
 #include <random>
 
+// PCG32 random number generator (pcg-random.org). Its state is a single
+// 64 bit word, so seeding it is cheap enough to do for every sample.
+class Pcg32
+{
+public:
+    using result_type = std::uint32_t;
+
+    explicit Pcg32(std::uint64_t seed)
+    {
+        operator()();
+        m_state += seed;
+        operator()();
+    }
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return 0xffffffffu; }
+
+    result_type operator()()
+    {
+        const auto old_state = m_state;
+        m_state = old_state * 6364136223846793005ull + m_increment;
+        const auto xorshifted = (std::uint32_t)(((old_state >> 18u) ^ old_state) >> 27u);
+        const auto rotation = (std::uint32_t)(old_state >> 59u);
+        return (xorshifted >> rotation) | (xorshifted << ((-rotation) & 31));
+    }
+
+private:
+    std::uint64_t m_state{0};
+    std::uint64_t m_increment{1442695040888963407ull};
+};
+
+// splitmix64 finalizer, used to turn structured seeds into well mixed ones
+constexpr std::uint64_t mix_seed(std::uint64_t z)
+{
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+// Seed for the random stream of a single sample. It depends only on the
+// render seed, the pixel and the sample index, so a render is reproducible
+// no matter which thread traces which sample, or in which order.
+constexpr std::uint64_t sample_seed(std::uint64_t seed, int x, int y, int sample)
+{
+    auto hash = mix_seed(seed + 0x9e3779b97f4a7c15ull);
+    hash = mix_seed(hash ^ (((std::uint64_t)(std::uint32_t)x << 32) | (std::uint32_t)y));
+    return mix_seed(hash ^ (std::uint32_t)sample);
+}
+
 class Rng
 {
 public:
-    Rng(unsigned seed) : m_random_engine{seed} {}
+    Rng(unsigned seed) : m_random_engine{mix_seed(seed)} {}
+    Rng(std::uint64_t seed, int x, int y, int sample)
+        : m_random_engine{sample_seed(seed, x, y, sample)}
+    {}
 
     template <typename T>
     T random()
     {
-        static std::uniform_real_distribution<T> distr(0, 1);
+        std::uniform_real_distribution<T> distr(0, 1);
         return distr(m_random_engine);
     }
 
@@ -27,5 +80,5 @@ private:
     Rng& operator=(const Rng&) = delete;
     Rng& operator=(Rng&&) = delete;
 
-    std::mt19937 m_random_engine;
+    Pcg32 m_random_engine;
 };
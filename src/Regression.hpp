@@ -0,0 +1,247 @@
+#pragma once
+
+#include "Point.hpp"
+#include "Vec.hpp"
+#include "VecMath.hpp"
+#include "Color.hpp"
+#include "Camera.hpp"
+#include "Image.hpp"
+#include "Ppm.hpp"
+#include "ParallelRender.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+struct ImageComparison
+{
+    bool same_size{false};
+    bool identical{false};
+    int max_difference{0};
+
+    // Peak signal to noise ratio over all pixels, and over the averages of
+    // blocks of pixels. Averaging blocks removes most of the sampling noise,
+    // so the block PSNR stays high when only the random streams changed.
+    double psnr{0};
+    double block_psnr{0};
+
+    // Largest difference between the averages of a block in a channel.
+    // Catches changes that are confined to a small part of the image.
+    double max_block_difference{0};
+
+    // Mean signed difference per channel, which shows a systematic change in
+    // brightness or color that noise alone would not explain
+    double bias[3]{};
+};
+
+inline double psnr_from_squared_error(double squared_error, long count)
+{
+    if (squared_error == 0)
+    {
+        return INFINITY;
+    }
+    return 10 * log10(255.0 * 255.0 * count / squared_error);
+}
+
+inline ImageComparison compare_images(
+    const PpmImage& image,
+    const PpmImage& reference,
+    int block_size = 4)
+{
+    ImageComparison result;
+    if (image.width != reference.width || image.height != reference.height)
+    {
+        return result;
+    }
+    result.same_size = true;
+
+    double squared_error = 0;
+    for (std::size_t i = 0; i < image.pixels.size(); ++i)
+    {
+        const auto& p = image.pixels[i];
+        const auto& q = reference.pixels[i];
+        const int difference[3] = {p.r() - q.r(), p.g() - q.g(), p.b() - q.b()};
+        for (int c = 0; c < 3; ++c)
+        {
+            squared_error += difference[c] * difference[c];
+            result.bias[c] += difference[c];
+            result.max_difference = std::max(result.max_difference, abs(difference[c]));
+        }
+    }
+
+    const long count = image.pixels.size();
+    result.identical = result.max_difference == 0;
+    result.psnr = psnr_from_squared_error(squared_error, 3 * count);
+    for (auto& bias : result.bias)
+    {
+        bias /= count;
+    }
+
+    double block_squared_error = 0;
+    long num_blocks = 0;
+    for (int by = 0; by + block_size <= image.height; by += block_size)
+    {
+        for (int bx = 0; bx + block_size <= image.width; bx += block_size)
+        {
+            double difference[3] = {};
+            for (int y = by; y < by + block_size; ++y)
+            {
+                for (int x = bx; x < bx + block_size; ++x)
+                {
+                    const auto& p = image.pixels[y * image.width + x];
+                    const auto& q = reference.pixels[y * image.width + x];
+                    difference[0] += p.r() - q.r();
+                    difference[1] += p.g() - q.g();
+                    difference[2] += p.b() - q.b();
+                }
+            }
+            for (auto d : difference)
+            {
+                d /= block_size * block_size;
+                block_squared_error += d * d;
+                result.max_block_difference = std::max(result.max_block_difference, fabs(d));
+            }
+            ++num_blocks;
+        }
+    }
+    result.block_psnr = psnr_from_squared_error(block_squared_error, 3 * num_blocks);
+
+    return result;
+}
+
+template <typename Image>
+PpmImage to_ppm_image(const Image& image)
+{
+    PpmImage result;
+    result.width = image.width;
+    result.height = image.height;
+    for (int y = image.height-1; y >= 0; --y)
+    {
+        for (int x = 0; x < image.width; ++x)
+        {
+            result.pixels.push_back(image[x][y]);
+        }
+    }
+    return result;
+}
+
+// A small render that is compared against a stored golden image
+struct ReferenceRender
+{
+    const char* name;
+    unsigned scene_seed;
+    Point3<double> lookfrom;
+    Point3<double> lookat;
+    double vfov;
+    double aperture;
+    int width;
+    int height;
+    int num_samples_per_pixel;
+    int max_depth;
+};
+
+constexpr ReferenceRender reference_renders[] = {
+    {"cover",   1, {13, 2, 3},  {0, 0, 0},   20, 0.1, 160, 90, 16, 50},
+    {"closeup", 2, {3, 1.5, 4}, {0, 0.5, 0}, 40, 0,   160, 90, 16, 50},
+    {"above",   3, {0, 20, 1},  {0, 0, 0},   60, 0,   96,  96, 16, 8},
+};
+
+struct RegressionTolerance
+{
+    double min_block_psnr{30};
+    double max_block_difference{20};
+    double max_bias{1.5};
+};
+
+// Render every reference render deterministically and compare it against
+// <directory>/<name>.ppm. An identical image passes exactly. Otherwise the
+// image passes statistically if its block PSNR and bias are within the
+// tolerance, which is what is expected from a change that only reorders
+// floating point operations. With update set, the golden images are
+// rewritten instead. Returns the number of failures.
+template <typename T>
+int run_regression_suite(
+    const std::string& directory,
+    bool update,
+    const RegressionTolerance& tolerance,
+    unsigned num_threads)
+{
+    int num_failures = 0;
+
+    for (const auto& reference : reference_renders)
+    {
+        const Camera<T> camera{
+            Point3<T>(reference.lookfrom.x(), reference.lookfrom.y(), reference.lookfrom.z()),
+            Point3<T>(reference.lookat.x(), reference.lookat.y(), reference.lookat.z()),
+            Vec3<T>{0, 1, 0},
+            (T)reference.vfov,
+            (T)reference.width/reference.height,
+            (T)reference.aperture,
+            (T)make_vec(reference.lookfrom, reference.lookat).length()
+        };
+
+        MappedImage<Color<int>> image{reference.width, reference.height};
+        ParallelRenderOptions options;
+        options.num_threads = num_threads;
+        options.deterministic = true;
+        generate_image_parallel<T>(
+            image, reference.scene_seed, camera,
+            reference.num_samples_per_pixel, reference.max_depth,
+            reference.scene_seed, options);
+
+        const auto path = directory + "/" + reference.name + ".ppm";
+        if (update)
+        {
+            FILE* file = fopen(path.c_str(), "w");
+            if (file == nullptr)
+            {
+                fprintf(stderr, "Could not open %s\n", path.c_str());
+                ++num_failures;
+                continue;
+            }
+            print_ppm_image(image, file);
+            fclose(file);
+            printf("%-10s updated\n", reference.name);
+            continue;
+        }
+
+        PpmImage golden;
+        if (!read_ppm_image(path.c_str(), golden))
+        {
+            printf("%-10s FAIL  could not read %s\n", reference.name, path.c_str());
+            ++num_failures;
+            continue;
+        }
+
+        const auto comparison = compare_images(to_ppm_image(image), golden);
+        if (!comparison.same_size)
+        {
+            printf("%-10s FAIL  size differs from %s\n", reference.name, path.c_str());
+            ++num_failures;
+            continue;
+        }
+
+        const bool close = comparison.block_psnr >= tolerance.min_block_psnr &&
+            comparison.max_block_difference <= tolerance.max_block_difference &&
+            fabs(comparison.bias[0]) <= tolerance.max_bias &&
+            fabs(comparison.bias[1]) <= tolerance.max_bias &&
+            fabs(comparison.bias[2]) <= tolerance.max_bias;
+
+        printf("%-10s %s  psnr %.2f dB, block psnr %.2f dB, max diff %d, "
+               "max block diff %.1f, bias %+.2f %+.2f %+.2f\n",
+               reference.name,
+               comparison.identical ? "EXACT" : close ? "CLOSE" : "FAIL ",
+               comparison.psnr, comparison.block_psnr, comparison.max_difference,
+               comparison.max_block_difference,
+               comparison.bias[0], comparison.bias[1], comparison.bias[2]);
+
+        if (!comparison.identical && !close)
+        {
+            ++num_failures;
+        }
+    }
+
+    return num_failures;
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include "Point.hpp"
+#include "Vec.hpp"
+#include "VecMath.hpp"
+#include "Ray.hpp"
+#include "Color.hpp"
+#include "HitRecord.hpp"
+#include "Material.hpp"
+#include "Random.hpp"
+
+#include <cstdint>
+#include <limits>
+
+// A depth limit known at compile time. Passed to color() instead of an int,
+// the recursion is instantiated once per bounce and the depth checks fold
+// away.
+template <int DEPTH>
+struct FixedDepth {};
+
+inline bool depth_exhausted(int depth) { return depth <= 0; }
+inline int next_depth(int depth) { return depth - 1; }
+
+template <int DEPTH>
+constexpr bool depth_exhausted(FixedDepth<DEPTH>) { return DEPTH <= 0; }
+
+template <int DEPTH>
+constexpr FixedDepth<(DEPTH > 0 ? DEPTH - 1 : 0)> next_depth(FixedDepth<DEPTH>) { return {}; }
+
+template <typename T, typename World, typename Depth>
+Color<T> color(
+    const Ray3<Point3<T>, Vec3<T>>& ray,
+    const World& world,
+    Depth depth,
+    Rng& rng)
+{
+    HitRecord<T> hit_record;
+
+    if (depth_exhausted(depth))
+    {
+        return {0, 0, 0};
+    }
+
+    constexpr T t_min = 0.001;
+    constexpr T t_max = std::numeric_limits<T>::max();
+
+    if (world.hit(ray, t_min, t_max, hit_record))
+    {
+        Ray3<Point3<T>, Vec3<T>> scattered;
+        Vec3<T> attenuation;
+        bool ray_was_scattered = hit_record.material->scatter(
+            ray, hit_record, attenuation, scattered, rng);
+
+        if (ray_was_scattered)
+        {
+            auto pixel_color = color<T, World>(scattered, world, next_depth(depth), rng);
+            return attenuation * pixel_color;
+        }
+        else
+        {
+            return {0, 0, 0};
+        }
+    }
+    else
+    {
+        auto unit_direction = unit_vector(ray.direction());
+        auto t = (unit_direction.y() + 1) / 2;
+        auto result = (1 - t) * Vec3<T>{1.0, 1.0, 1.0} +
+                           t  * Vec3<T>{0.5, 0.7, 1.0};
+        return {result.x(), result.y(), result.z()};
+    }
+}
+
+// Average num_samples jittered samples of pixel (x, y) in linear color space
+template <typename T, typename World, typename Camera, typename Depth>
+Color<T> sample_pixel(
+    int x, int y,
+    int width, int height,
+    const World& world,
+    const Camera& camera,
+    int num_samples,
+    Depth max_depth,
+    Rng& rng)
+{
+    Color<T> pixel_color{0, 0, 0};
+    for (int sample = 0; sample < num_samples; ++sample)
+    {
+        const auto u = (x + rng.random<T>())/(width-1);
+        const auto v = (y + rng.random<T>())/(height-1);
+        const auto ray = camera.get_ray(u, v, rng);
+
+        pixel_color = pixel_color + color<T, World>(ray, world, max_depth, rng);
+    }
+    return pixel_color / (T) num_samples;
+}
+
+// Like sample_pixel, but every sample draws from its own random stream that
+// depends only on (seed, pixel, sample index). The result is bit-identical no
+// matter how the image is split between threads.
+template <typename T, typename World, typename Camera, typename Depth>
+Color<T> sample_pixel_deterministic(
+    int x, int y,
+    int width, int height,
+    const World& world,
+    const Camera& camera,
+    int num_samples,
+    Depth max_depth,
+    std::uint64_t seed)
+{
+    Color<T> pixel_color{0, 0, 0};
+    for (int sample = 0; sample < num_samples; ++sample)
+    {
+        Rng rng{seed, x, y, sample};
+        const auto u = (x + rng.random<T>())/(width-1);
+        const auto v = (y + rng.random<T>())/(height-1);
+        const auto ray = camera.get_ray(u, v, rng);
+
+        pixel_color = pixel_color + color<T, World>(ray, world, max_depth, rng);
+    }
+    return pixel_color / (T) num_samples;
+}
+
+template <typename T>
+Color<int> to_pixel(Color<T> pixel_color)
+{
+    pixel_color = gamma_correct(pixel_color);
+
+    return {
+        int(255.99f * pixel_color.r()),
+        int(255.99f * pixel_color.g()),
+        int(255.99f * pixel_color.b())
+    };
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "Point.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+
+// The settings of a render: image size, samples, depth, seeds and camera.
+// The render server, batch files and the command line give them as key=value
+// arguments, read by parse_render_request.
+template <typename T>
+struct RenderRequest
+{
+    unsigned scene_seed{0};
+    int width{400};
+    int height{225};
+    int num_samples_per_pixel{100};
+    int max_depth{50};
+    int priority{0};
+    unsigned seed{0};
+    Point3<T> lookfrom{13, 2, 3};
+    Point3<T> lookat{0, 0, 0};
+    T vfov{20};
+    T aperture{0.1};
+    T focus_dist{10};
+};
+
+template <typename T>
+bool parse_point(const std::string& value, Point3<T>& point)
+{
+    double x, y, z;
+    if (sscanf(value.c_str(), "%lf,%lf,%lf", &x, &y, &z) != 3)
+    {
+        return false;
+    }
+    point = {(T)x, (T)y, (T)z};
+    return true;
+}
+
+// Parse the arguments of a render command. On failure, error describes the
+// offending argument.
+template <typename T>
+bool parse_render_request(
+    const std::string& arguments,
+    RenderRequest<T>& request,
+    std::string& error)
+{
+    std::istringstream stream{arguments};
+    std::string argument;
+    while (stream >> argument)
+    {
+        const auto equals = argument.find('=');
+        if (equals == std::string::npos)
+        {
+            error = "expected key=value: " + argument;
+            return false;
+        }
+
+        const auto key = argument.substr(0, equals);
+        const auto value = argument.substr(equals + 1);
+        const char* v = value.c_str();
+        bool ok = true;
+
+        if      (key == "scene")    { request.scene_seed = strtoul(v, nullptr, 10); }
+        else if (key == "width")    { request.width = atoi(v); }
+        else if (key == "height")   { request.height = atoi(v); }
+        else if (key == "spp")      { request.num_samples_per_pixel = atoi(v); }
+        else if (key == "depth")    { request.max_depth = atoi(v); }
+        else if (key == "priority") { request.priority = atoi(v); }
+        else if (key == "seed")     { request.seed = strtoul(v, nullptr, 10); }
+        else if (key == "lookfrom") { ok = parse_point(value, request.lookfrom); }
+        else if (key == "lookat")   { ok = parse_point(value, request.lookat); }
+        else if (key == "vfov")     { request.vfov = atof(v); }
+        else if (key == "aperture") { request.aperture = atof(v); }
+        else if (key == "focus")    { request.focus_dist = atof(v); }
+        else
+        {
+            error = "unknown key: " + key;
+            return false;
+        }
+
+        if (!ok)
+        {
+            error = "bad value: " + argument;
+            return false;
+        }
+    }
+
+    if (request.width < 2 || request.height < 2 ||
+        request.num_samples_per_pixel < 1 || request.max_depth < 1)
+    {
+        error = "width and height must be at least 2, spp and depth at least 1";
+        return false;
+    }
+
+    return true;
+}
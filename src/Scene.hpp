@@ -0,0 +1,161 @@
+#pragma once
+
+#include "Point.hpp"
+#include "Vec.hpp"
+#include "VecMath.hpp"
+#include "Sphere.hpp"
+#include "Material.hpp"
+#include "World.hpp"
+#include "Grid.hpp"
+#include "Random.hpp"
+
+#include <deque>
+#include <memory>
+#include <vector>
+
+// The random scene from the cover of "Ray Tracing in One Weekend". The scene
+// owns its spheres and materials so that several scenes can be resident at
+// the same time.
+//
+// Small spheres are placed on a lattice from -lattice_radius to
+// lattice_radius in x and z; the book's scene has a radius of 11. The
+// spheres and materials compute with the math policy MATH.
+template <typename T, typename MATH = ExactMath>
+class Scene
+{
+public:
+    using SphereContainer = std::vector<Sphere3<T, MATH>>;
+    using Accelerator = UniformGrid<T, const SphereContainer>;
+
+    explicit Scene(unsigned seed, int lattice_radius = 11)
+        :
+        m_range_min{-lattice_radius},
+        m_range_max{lattice_radius},
+        m_world{m_spheres}
+    {
+        Rng rng{seed};
+        generate(rng);
+        m_accelerator = std::make_unique<Accelerator>(m_spheres);
+    }
+
+    // Every sphere in a list, tested one after the other
+    const World<T, const SphereContainer>& world() const { return m_world; }
+
+    // The acceleration structure to trace rays against
+    const Accelerator& accelerator() const { return *m_accelerator; }
+
+    const SphereContainer& spheres() const { return m_spheres; }
+
+    // Edits for trying out changes to the generated scene. The accelerator
+    // is rebuilt after each one.
+    void move_sphere(std::size_t index, const Vec3<T>& offset)
+    {
+        const auto& sphere = m_spheres[index];
+        m_spheres[index] = {sphere.center() + offset, sphere.radius(), sphere.material()};
+        m_accelerator = std::make_unique<Accelerator>(m_spheres);
+    }
+
+    // Give one sphere a diffuse material of its own
+    void recolor_sphere(std::size_t index, const Vec3<T>& albedo)
+    {
+        const auto& sphere = m_spheres[index];
+        m_material_edits.emplace_back(albedo);
+        m_spheres[index] = {sphere.center(), sphere.radius(), &m_material_edits.back()};
+        m_accelerator = std::make_unique<Accelerator>(m_spheres);
+    }
+
+private:
+    // Spheres point to the materials, so the scene cannot be copied or moved
+    Scene(const Scene&) = delete;
+    Scene(Scene&&) = delete;
+    Scene& operator=(const Scene&) = delete;
+    Scene& operator=(Scene&&) = delete;
+
+    void generate(Rng& rng)
+    {
+        const int num_random = (m_range_max - m_range_min)*(m_range_max - m_range_min);
+        const int num_lamb = num_random * 0.8;
+        const int num_metal = num_random * 0.15;
+        const int num_glass = num_random - num_lamb - num_metal;
+
+        // Spheres point into the material lists, so they must not reallocate
+        m_material_lamb.resize(num_lamb);
+        m_material_metal.resize(num_metal);
+        m_material_glass.resize(num_glass);
+
+        m_spheres.reserve(4 + num_random);
+        m_spheres.push_back({ Point3<T>{0, -1000, 0}, 1000, &m_material_ground });
+        m_spheres.push_back({ Point3<T>{ 0, 1, 0}, 1,       &m_material1 });
+        m_spheres.push_back({ Point3<T>{-4, 1, 0}, 1,       &m_material2 });
+        m_spheres.push_back({ Point3<T>{ 4, 1, 0}, 1,       &m_material3 });
+
+        for (auto& mat : m_material_lamb)
+        {
+            mat = {Vec3<T>{
+                    rng.random<T>(),
+                    rng.random<T>(),
+                    rng.random<T>()}};
+        }
+
+        for (auto& mat : m_material_metal)
+        {
+            auto albedo = Vec3<T>{
+                rng.random<T>(0.5, 1),
+                rng.random<T>(0.5, 1),
+                rng.random<T>(0.5, 1)
+            };
+            auto fuzz = rng.random<T>(0, 0.5);
+            mat = {albedo, fuzz};
+        }
+
+        for (auto& mat : m_material_glass)
+        {
+            mat = {1.5};
+        }
+
+        for (int a = m_range_min; a < m_range_max; a++) {
+            for (int b = m_range_min; b < m_range_max; b++) {
+                auto choose_mat = rng.random<T>();
+                Point3<T> center(a + 0.9 * rng.random<T>(),
+                                 0.2,
+                                 b + 0.9 * rng.random<T>());
+
+                if (make_vec(center, Point3<T>{4, 0.2, 0}).length() > 0.9) {
+                    if (choose_mat < 0.8) {
+                        // diffuse
+                        auto m = rng.random<T>() * num_lamb;
+                        auto& material = m_material_lamb[(int)m];
+                        m_spheres.push_back({center, 0.2, &material});
+                    } else if (choose_mat < 0.95) {
+                        // metal
+                        auto m = rng.random<T>() * num_metal;
+                        auto& material = m_material_metal[(int)m];
+                        m_spheres.push_back({center, 0.2, &material});
+                    } else {
+                        // glass
+                        auto m = rng.random<T>() * num_glass;
+                        auto& material = m_material_glass[(int)m];
+                        m_spheres.push_back({center, 0.2, &material});
+                    }
+                }
+            }
+        }
+    }
+
+    Lambertian<T, MATH> m_material_ground{Vec3<T>{0.5, 0.5, 0.5}};
+    Dialectric<T, MATH> m_material1{1.5};
+    Lambertian<T, MATH> m_material2{Vec3<T>{0.4, 0.2, 0.1}};
+    Metal<T, MATH>      m_material3{Vec3<T>{0.7, 0.6, 0.5}, 0};
+
+    std::vector<Lambertian<T, MATH>>  m_material_lamb;
+    std::vector<Metal<T, MATH>>       m_material_metal;
+    std::vector<Dialectric<T, MATH>>  m_material_glass;
+    std::deque<Lambertian<T, MATH>>   m_material_edits;
+
+    const int m_range_min;
+    const int m_range_max;
+
+    SphereContainer m_spheres;
+    World<T, const SphereContainer> m_world;
+    std::unique_ptr<Accelerator> m_accelerator;
+};
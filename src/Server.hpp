@@ -0,0 +1,504 @@
+#pragma once
+
+#include "Point.hpp"
+#include "Vec.hpp"
+#include "Color.hpp"
+#include "Camera.hpp"
+#include "Hash.hpp"
+#include "RenderRequest.hpp"
+#include "Scene.hpp"
+#include "Render.hpp"
+#include "Random.hpp"
+#include "ThreadPool.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// A render server keeps scenes resident between jobs and renders them on a
+// shared pool of worker threads. Clients talk to it over a Unix socket with a
+// line based protocol:
+//
+//   render [scene=<seed>] [width=<w>] [height=<h>] [spp=<n>] [depth=<n>]
+//          [priority=<n>] [seed=<n>] [lookfrom=<x>,<y>,<z>]
+//          [lookat=<x>,<y>,<z>] [vfov=<deg>] [aperture=<a>] [focus=<d>]
+//   cancel <job id>
+//
+// A render command is answered with "job <id>" followed by the image as a
+// PPM, streamed row by row as the rows finish. If the job is cancelled the
+// stream ends with a "cancelled" line instead. Closing the connection
+// cancels the jobs that were started on it. Errors are reported with a line
+// starting with "error".
+//
+// A connection handles one command at a time: while a job streams, no more
+// commands are read from its connection. To cancel a job before its image
+// is complete, send cancel from another connection, or close the one that
+// started it.
+//
+// Requests larger than the limits of RenderServer are answered with an
+// error, since the rows of a job are held in memory until they are sent.
+
+// Resident scenes, keyed by a hash of their description. The least recently
+// used scene is dropped when there are too many. Jobs hold on to their scene,
+// so dropping a scene never affects a running job.
+template <typename T>
+class SceneCache
+{
+public:
+    explicit SceneCache(std::size_t max_scenes) : m_max_scenes{max_scenes} {}
+
+    std::shared_ptr<const Scene<T>> get(unsigned scene_seed)
+    {
+        const auto key = hash_bytes(&scene_seed, sizeof(scene_seed));
+
+        {
+            std::lock_guard<std::mutex> lock{m_mutex};
+            auto it = m_scenes.find(key);
+            if (it != m_scenes.end())
+            {
+                it->second.last_used = ++m_clock;
+                return it->second.scene;
+            }
+        }
+
+        // Build the scene without holding the lock, so that other
+        // connections are not held up. If another connection built the same
+        // scene meanwhile, use that one.
+        auto scene = std::make_shared<const Scene<T>>(scene_seed);
+
+        // Declared before the lock, so a dropped scene is freed after it is
+        // released
+        std::shared_ptr<const Scene<T>> dropped;
+        std::lock_guard<std::mutex> lock{m_mutex};
+        auto it = m_scenes.find(key);
+        if (it != m_scenes.end())
+        {
+            it->second.last_used = ++m_clock;
+            return it->second.scene;
+        }
+
+        if (m_scenes.size() >= m_max_scenes)
+        {
+            auto oldest = m_scenes.begin();
+            for (auto i = m_scenes.begin(); i != m_scenes.end(); ++i)
+            {
+                if (i->second.last_used < oldest->second.last_used)
+                {
+                    oldest = i;
+                }
+            }
+            dropped = std::move(oldest->second.scene);
+            m_scenes.erase(oldest);
+        }
+
+        m_scenes[key] = {scene, ++m_clock};
+        return scene;
+    }
+
+private:
+    struct Entry
+    {
+        std::shared_ptr<const Scene<T>> scene;
+        std::uint64_t last_used;
+    };
+
+    std::mutex m_mutex;
+    std::map<std::uint64_t, Entry> m_scenes;
+    std::uint64_t m_clock{0};
+    std::size_t m_max_scenes;
+};
+
+// A render in progress. Rows are rendered by the thread pool and handed to
+// the connection that submitted the job in PPM order (top row first).
+template <typename T>
+struct RenderJob
+{
+    RenderJob(std::uint64_t job_id,
+              const RenderRequest<T>& job_request,
+              std::shared_ptr<const Scene<T>> job_scene)
+        :
+        id{job_id},
+        request{job_request},
+        scene{std::move(job_scene)},
+        camera{
+            job_request.lookfrom,
+            job_request.lookat,
+            Vec3<T>{0, 1, 0},
+            job_request.vfov,
+            (T)job_request.width/job_request.height,
+            job_request.aperture,
+            job_request.focus_dist},
+        rows(job_request.height),
+        row_done(job_request.height, false)
+    {}
+
+    void render_row(int y)
+    {
+        if (!cancelled)
+        {
+            auto& row = rows[y];
+            char pixel_text[32];
+            for (int x = 0; x < request.width; ++x)
+            {
+                auto pixel = to_pixel(sample_pixel_deterministic<T>(
+                    x, y, request.width, request.height,
+                    scene->accelerator(), camera,
+                    request.num_samples_per_pixel, request.max_depth,
+                    request.seed));
+                snprintf(pixel_text, sizeof(pixel_text), "%d %d %d\n",
+                         pixel.r(), pixel.g(), pixel.b());
+                row += pixel_text;
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            row_done[y] = true;
+        }
+        condition.notify_all();
+    }
+
+    const std::uint64_t id;
+    const RenderRequest<T> request;
+    const std::shared_ptr<const Scene<T>> scene;
+    const Camera<T> camera;
+    std::atomic<bool> cancelled{false};
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::vector<std::string> rows;
+    std::vector<bool> row_done;
+};
+
+template <typename T>
+class RenderServer
+{
+public:
+    // Largest request the server accepts
+    static constexpr int max_width = 16384;
+    static constexpr int max_height = 16384;
+    static constexpr long long max_samples = 1LL << 36;
+    static constexpr int max_depth = 1000;
+
+    RenderServer(std::string socket_path, unsigned num_threads, std::size_t max_scenes)
+        :
+        m_socket_path{std::move(socket_path)},
+        m_pool{num_threads},
+        m_scenes{max_scenes}
+    {}
+
+    // Accept connections until the process is stopped. Returns false if the
+    // socket could not be set up.
+    bool run()
+    {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (m_socket_path.size() >= sizeof(address.sun_path))
+        {
+            fprintf(stderr, "Socket path too long: %s\n", m_socket_path.c_str());
+            return false;
+        }
+        strcpy(address.sun_path, m_socket_path.c_str());
+
+        int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener < 0)
+        {
+            perror("socket");
+            return false;
+        }
+
+        unlink(m_socket_path.c_str());
+        if (bind(listener, (sockaddr*)&address, sizeof(address)) < 0 ||
+            listen(listener, 16) < 0)
+        {
+            perror(m_socket_path.c_str());
+            close(listener);
+            return false;
+        }
+
+        fprintf(stderr, "Listening on %s with %u threads\n",
+                m_socket_path.c_str(), m_pool.size());
+
+        for (;;)
+        {
+            int connection = accept(listener, nullptr, nullptr);
+            if (connection < 0)
+            {
+                // Out of file descriptors or memory: wait for connections to
+                // close rather than retrying at once
+                perror("accept");
+                std::this_thread::sleep_for(std::chrono::milliseconds{100});
+                continue;
+            }
+            std::thread{[this, connection] { serve(connection); }}.detach();
+        }
+    }
+
+private:
+    static bool send_all(int fd, const std::string& data)
+    {
+        std::size_t sent = 0;
+        while (sent < data.size())
+        {
+            auto n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0)
+            {
+                return false;
+            }
+            sent += n;
+        }
+        return true;
+    }
+
+    // Reads the lines of a connection, a block at a time
+    class LineReader
+    {
+    public:
+        enum Result { line_read, closed, too_long };
+
+        // Longest line accepted, without its newline
+        static constexpr std::size_t max_line_length = 4096;
+
+        explicit LineReader(int fd) : m_fd{fd} {}
+
+        Result read_line(std::string& line)
+        {
+            line.clear();
+            for (;;)
+            {
+                for (; m_begin < m_end; ++m_begin)
+                {
+                    const char c = m_buffer[m_begin];
+                    if (c == '\n')
+                    {
+                        ++m_begin;
+                        return line_read;
+                    }
+                    if (c != '\r')
+                    {
+                        if (line.size() == max_line_length)
+                        {
+                            return too_long;
+                        }
+                        line += c;
+                    }
+                }
+
+                const auto n = read(m_fd, m_buffer, sizeof(m_buffer));
+                if (n <= 0)
+                {
+                    return line.empty() ? closed : line_read;
+                }
+                m_begin = 0;
+                m_end = n;
+            }
+        }
+
+    private:
+        int m_fd;
+        char m_buffer[4096];
+        std::size_t m_begin{0};
+        std::size_t m_end{0};
+    };
+
+    // Serve the commands of a connection. An exception only ends the
+    // connection it was thrown for, never the server.
+    void serve(int connection)
+    {
+        try
+        {
+            serve_commands(connection);
+        }
+        catch (const std::exception& exception)
+        {
+            fprintf(stderr, "Connection failed: %s\n", exception.what());
+            send_all(connection, std::string{"error "} + exception.what() + "\n");
+        }
+        catch (...)
+        {
+            fprintf(stderr, "Connection failed\n");
+            send_all(connection, "error internal error\n");
+        }
+        close(connection);
+    }
+
+    void serve_commands(int connection)
+    {
+        LineReader reader{connection};
+        std::string line;
+        for (;;)
+        {
+            const auto result = reader.read_line(line);
+            if (result == LineReader::too_long)
+            {
+                send_all(connection, "error line too long\n");
+                break;
+            }
+            if (result == LineReader::closed)
+            {
+                break;
+            }
+
+            std::istringstream stream{line};
+            std::string command;
+            stream >> command;
+
+            std::string arguments;
+            std::getline(stream, arguments);
+
+            bool ok = true;
+            if (command == "render")
+            {
+                ok = render(connection, arguments);
+            }
+            else if (command == "cancel")
+            {
+                const auto id = strtoull(arguments.c_str(), nullptr, 10);
+                ok = send_all(connection, cancel(id) ?
+                    "ok\n" : "error no such job\n");
+            }
+            else if (!command.empty())
+            {
+                ok = send_all(connection, "error unknown command: " + command + "\n");
+            }
+
+            if (!ok)
+            {
+                break;
+            }
+        }
+    }
+
+    static bool within_limits(const RenderRequest<T>& request, std::string& error)
+    {
+        if (request.width > max_width || request.height > max_height)
+        {
+            error = "width must be at most " + std::to_string(max_width) +
+                " and height at most " + std::to_string(max_height);
+            return false;
+        }
+        if ((long long)request.width * request.height *
+                request.num_samples_per_pixel > max_samples)
+        {
+            error = "spp x width x height must be at most " + std::to_string(max_samples);
+            return false;
+        }
+        if (request.max_depth > max_depth)
+        {
+            error = "depth must be at most " + std::to_string(max_depth);
+            return false;
+        }
+        return true;
+    }
+
+    // Returns false if the connection was lost
+    bool render(int connection, const std::string& arguments)
+    {
+        RenderRequest<T> request;
+        std::string error;
+        if (!parse_render_request(arguments, request, error) ||
+            !within_limits(request, error))
+        {
+            return send_all(connection, "error " + error + "\n");
+        }
+
+        auto job = std::make_shared<RenderJob<T>>(
+            ++m_next_job_id, request, m_scenes.get(request.scene_seed));
+
+        {
+            std::lock_guard<std::mutex> lock{m_jobs_mutex};
+            m_jobs[job->id] = job;
+        }
+
+        try
+        {
+            return stream_job(connection, job);
+        }
+        catch (...)
+        {
+            job->cancelled = true;
+            std::lock_guard<std::mutex> lock{m_jobs_mutex};
+            m_jobs.erase(job->id);
+            throw;
+        }
+    }
+
+    // Returns false if the connection was lost
+    bool stream_job(int connection, const std::shared_ptr<RenderJob<T>>& job)
+    {
+        const auto& request = job->request;
+
+        // Submit the rows in the order they are streamed
+        for (int y = request.height - 1; y >= 0; --y)
+        {
+            m_pool.submit([job, y] { job->render_row(y); }, request.priority);
+        }
+
+        char header[96];
+        snprintf(header, sizeof(header), "job %llu\nP3\n%d %d\n255\n",
+                 (unsigned long long)job->id, request.width, request.height);
+        bool connected = send_all(connection, header);
+
+        for (int y = request.height - 1; y >= 0 && connected; --y)
+        {
+            {
+                std::unique_lock<std::mutex> lock{job->mutex};
+                job->condition.wait(lock, [&] { return job->row_done[y]; });
+            }
+
+            if (job->cancelled)
+            {
+                connected = send_all(connection, "cancelled\n");
+                break;
+            }
+
+            connected = send_all(connection, job->rows[y]);
+            job->rows[y] = {};
+        }
+
+        if (!connected)
+        {
+            job->cancelled = true;
+        }
+
+        std::lock_guard<std::mutex> lock{m_jobs_mutex};
+        m_jobs.erase(job->id);
+        return connected;
+    }
+
+    bool cancel(std::uint64_t id)
+    {
+        std::lock_guard<std::mutex> lock{m_jobs_mutex};
+        auto it = m_jobs.find(id);
+        if (it == m_jobs.end())
+        {
+            return false;
+        }
+        it->second->cancelled = true;
+        return true;
+    }
+
+    const std::string m_socket_path;
+    ThreadPool m_pool;
+    SceneCache<T> m_scenes;
+
+    std::mutex m_jobs_mutex;
+    std::map<std::uint64_t, std::shared_ptr<RenderJob<T>>> m_jobs;
+    std::atomic<std::uint64_t> m_next_job_id{0};
+};
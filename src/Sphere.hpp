@@ -4,7 +4,7 @@
 #include "Material.hpp"
 #include "Hit.hpp"
 
-template <typename T>
+template <typename T, typename MATH = ExactMath>
 class Sphere3 : public Hittable<T>
 {
 public:
@@ -22,10 +22,27 @@ public:
          T t_min,
          T t_max,
          HitRecord<T>& record) const override
+    {
+        T t;
+        if (!intersect(ray, t_min, t_max, t))
+        {
+            return false;
+        }
+        set_hit_record(ray, t, record);
+        return true;
+    }
+
+    // Distance to the nearest intersection within the range, without any of
+    // the hit attributes
+    bool intersect(
+         const Ray3<Point3<T>, Vec3<T>>& ray,
+         T t_min,
+         T t_max,
+         T& t) const
     {
         auto oc = make_vec(ray.origin(), m_center);
         auto a = ray.direction().squared_length();
-        auto half_b = dot(oc, ray.direction());
+        auto half_b = dot<T, MATH>(oc, ray.direction());
         auto c = oc.squared_length() - m_radius * m_radius;
         auto discriminant = half_b * half_b - a * c;
 
@@ -34,31 +51,39 @@ public:
             return false;
         }
 
-        auto sqrt_discriminant = sqrt(discriminant);
+        auto sqrt_discriminant = MATH::sqrt(discriminant);
 
         // Find the nearest root that is in the range
-        auto root = (-half_b - sqrt_discriminant) / a;
+        auto root = MATH::divide(-half_b - sqrt_discriminant, a);
 
         if (root < t_min || root > t_max)
         {
-             root = (-half_b + sqrt_discriminant) / a;
+             root = MATH::divide(-half_b + sqrt_discriminant, a);
              if (root < t_min || root > t_max)
              {
                  return false;
              }
         }
 
-        record.t = root;
+        t = root;
+        return true;
+    }
+
+    // The hit attributes of the intersection at t
+    void set_hit_record(
+         const Ray3<Point3<T>, Vec3<T>>& ray,
+         T t,
+         HitRecord<T>& record) const
+    {
+        record.t = t;
         record.p = ray.point_at_parameter(record.t);
 
-        auto outward_normal = make_vec(record.p, m_center) / m_radius;
+        auto outward_normal = MATH::divide(make_vec(record.p, m_center), m_radius);
 
-        record.front_face = dot(ray.direction(), outward_normal) < 0;
+        record.front_face = dot<T, MATH>(ray.direction(), outward_normal) < 0;
         record.normal = record.front_face ?
             outward_normal : -outward_normal;
         record.material = m_material;
-
-        return true;
     }
 
 private:
@@ -0,0 +1,182 @@
+#pragma once
+
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// A set of tasks with dependencies between them, run on a thread pool. A
+// task is submitted to the pool as soon as all of its prerequisites have
+// finished, so independent stages of different jobs overlap. Every task
+// belongs to a named stage and the time spent in each stage is recorded.
+class TaskGraph
+{
+public:
+    using TaskId = std::size_t;
+    using Clock = std::chrono::steady_clock;
+
+    explicit TaskGraph(ThreadPool& pool) : m_pool{pool} {}
+
+    TaskId add(std::string stage, std::function<void()> function, int priority = 0)
+    {
+        m_tasks.push_back({std::move(stage), std::move(function), priority});
+        return m_tasks.size() - 1;
+    }
+
+    // Make task wait for prerequisite to finish
+    void add_dependency(TaskId prerequisite, TaskId task)
+    {
+        m_tasks[prerequisite].successors.push_back(task);
+        ++m_tasks[task].num_prerequisites;
+    }
+
+    // Run every task and wait until they have all finished
+    void run()
+    {
+        m_remaining.reset(new std::atomic<int>[m_tasks.size()]);
+        for (std::size_t i = 0; i < m_tasks.size(); ++i)
+        {
+            m_remaining[i] = m_tasks[i].num_prerequisites;
+        }
+        m_num_finished = 0;
+        m_start = Clock::now();
+
+        std::vector<TaskId> ready;
+        for (TaskId task = 0; task < m_tasks.size(); ++task)
+        {
+            if (m_tasks[task].num_prerequisites == 0)
+            {
+                ready.push_back(task);
+            }
+        }
+        submit(ready);
+
+        std::unique_lock<std::mutex> lock{m_mutex};
+        m_finished.wait(lock, [this] { return m_num_finished == m_tasks.size(); });
+    }
+
+    struct StageTiming
+    {
+        std::string stage;
+        double first_start_ms{0};
+        double last_end_ms{0};
+        double busy_ms{0};
+        int num_tasks{0};
+    };
+
+    // Per stage: when its first task started, when its last task ended and
+    // how much time its tasks took in total, in order of first start
+    std::vector<StageTiming> stage_timings() const
+    {
+        std::map<std::string, StageTiming> stages;
+        for (const auto& task : m_tasks)
+        {
+            auto& timing = stages[task.stage];
+            if (timing.num_tasks == 0 || task.start_ms < timing.first_start_ms)
+            {
+                timing.first_start_ms = task.start_ms;
+            }
+            timing.stage = task.stage;
+            timing.last_end_ms = std::max(timing.last_end_ms, task.end_ms);
+            timing.busy_ms += task.end_ms - task.start_ms;
+            ++timing.num_tasks;
+        }
+
+        std::vector<StageTiming> timings;
+        for (const auto& stage : stages)
+        {
+            timings.push_back(stage.second);
+        }
+        std::sort(timings.begin(), timings.end(), [](const auto& t1, const auto& t2) {
+            return t1.first_start_ms < t2.first_start_ms;
+        });
+        return timings;
+    }
+
+    void print_timings(FILE* file = stderr) const
+    {
+        fprintf(file, "%-24s %10s %10s %10s %6s\n",
+                "stage", "start ms", "end ms", "busy ms", "tasks");
+        for (const auto& timing : stage_timings())
+        {
+            fprintf(file, "%-24s %10.1f %10.1f %10.1f %6d\n",
+                    timing.stage.c_str(), timing.first_start_ms,
+                    timing.last_end_ms, timing.busy_ms, timing.num_tasks);
+        }
+    }
+
+private:
+    struct Task
+    {
+        std::string stage;
+        std::function<void()> function;
+        int priority;
+        std::vector<TaskId> successors{};
+        int num_prerequisites{0};
+        double start_ms{0};
+        double end_ms{0};
+    };
+
+    double elapsed_ms() const
+    {
+        return std::chrono::duration<double, std::milli>(Clock::now() - m_start).count();
+    }
+
+    void submit(const std::vector<TaskId>& ids)
+    {
+        if (ids.empty())
+        {
+            return;
+        }
+
+        std::vector<std::pair<std::function<void()>, int>> tasks;
+        for (auto id : ids)
+        {
+            tasks.emplace_back([this, id] { execute(id); }, m_tasks[id].priority);
+        }
+        m_pool.submit(std::move(tasks));
+    }
+
+    void execute(TaskId id)
+    {
+        auto& task = m_tasks[id];
+        task.start_ms = elapsed_ms();
+        task.function();
+        task.end_ms = elapsed_ms();
+
+        std::vector<TaskId> ready;
+        for (auto successor : task.successors)
+        {
+            if (--m_remaining[successor] == 0)
+            {
+                ready.push_back(successor);
+            }
+        }
+        submit(ready);
+
+        // Notify with the lock held: once run() sees the last task counted,
+        // the graph may be destroyed, so this must not touch it afterwards
+        std::lock_guard<std::mutex> lock{m_mutex};
+        ++m_num_finished;
+        m_finished.notify_all();
+    }
+
+    ThreadPool& m_pool;
+    std::vector<Task> m_tasks;
+    std::unique_ptr<std::atomic<int>[]> m_remaining;
+    Clock::time_point m_start;
+
+    std::mutex m_mutex;
+    std::condition_variable m_finished;
+    std::size_t m_num_finished{0};
+};
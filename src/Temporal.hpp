@@ -0,0 +1,190 @@
+#pragma once
+
+#include "Point.hpp"
+#include "Vec.hpp"
+#include "VecMath.hpp"
+#include "Color.hpp"
+#include "HitRecord.hpp"
+#include "Camera.hpp"
+
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <optional>
+#include <vector>
+
+// First hit information for a pixel, used to decide whether a pixel from a
+// previous frame sees the same surface as a pixel in the current frame.
+template <typename T>
+struct GBufferSample
+{
+    bool hit{false};
+    Point3<T> p{};
+    Vec3<T> normal{};
+    T depth{};
+};
+
+// Accumulated linear radiance for a pixel and how many samples it holds.
+template <typename T>
+struct HistorySample
+{
+    Color<T> radiance{};
+    int num_samples{0};
+};
+
+// Accumulates samples across frames when only the camera moves. Each frame
+// the history of the previous frame is reprojected onto the current one
+// using the first hit position of every pixel. History is rejected where
+// the surface was not visible before (depth or normal mismatch).
+template <typename T>
+class TemporalAccumulator
+{
+public:
+    TemporalAccumulator(int w, int h)
+        :
+        width{w},
+        height{h}
+    {
+        for (int buffer = 0; buffer < 2; ++buffer)
+        {
+            m_gbuffer[buffer].resize((std::size_t)w * h);
+            m_history[buffer].resize((std::size_t)w * h);
+        }
+    }
+
+    const int width;
+    const int height;
+
+    // Fill the G-buffer of the current frame at pixel (x, y) with a pinhole
+    // ray through the center of the pixel. Only touches that pixel of the
+    // current frame, so pixels can be traced from several threads.
+    template <typename World>
+    void trace_gbuffer(int x, int y, const World& world, const Camera<T>& camera)
+    {
+        constexpr T t_min = 0.001;
+        constexpr T t_max = std::numeric_limits<T>::max();
+
+        const T u = (x + T(0.5)) / (width - 1);
+        const T v = (y + T(0.5)) / (height - 1);
+        const auto ray = camera.get_pinhole_ray(u, v);
+
+        HitRecord<T> record;
+        GBufferSample<T> sample;
+        if (world.hit(ray, t_min, t_max, record))
+        {
+            sample.hit = true;
+            sample.p = record.p;
+            sample.normal = record.normal;
+            sample.depth = make_vec(record.p, camera.origin()).length();
+        }
+        m_gbuffer[m_current][index(x, y)] = sample;
+    }
+
+    // Look up the history of the previous frame for the pixel (x, y) of the
+    // current frame. Returns an empty history if the pixel is disoccluded.
+    HistorySample<T> reproject(int x, int y) const
+    {
+        if (!m_previous_camera)
+        {
+            return {};
+        }
+
+        const auto& current = m_gbuffer[m_current][index(x, y)];
+        if (!current.hit)
+        {
+            return {};
+        }
+
+        T u, v;
+        if (!m_previous_camera->project(current.p, u, v))
+        {
+            return {};
+        }
+
+        const int px = int(u * (width - 1));
+        const int py = int(v * (height - 1));
+        if (u < 0 || v < 0 || px >= width || py >= height)
+        {
+            return {};
+        }
+
+        const auto& previous = m_gbuffer[previous_index()][index(px, py)];
+        if (!previous.hit)
+        {
+            return {};
+        }
+
+        const auto expected_depth =
+            make_vec(current.p, m_previous_camera->origin()).length();
+        if (std::abs(expected_depth - previous.depth) > m_depth_tolerance * previous.depth)
+        {
+            return {};
+        }
+
+        if (dot(current.normal, previous.normal) < m_normal_tolerance)
+        {
+            return {};
+        }
+
+        return m_history[previous_index()][index(px, py)];
+    }
+
+    // Blend the average of num_samples new samples into the reprojected
+    // history and store it as the history of the current frame. Returns
+    // the blended linear radiance.
+    Color<T> accumulate(
+        int x, int y,
+        const HistorySample<T>& history,
+        const Color<T>& radiance,
+        int num_samples)
+    {
+        auto total = history.num_samples + num_samples;
+        if (total > m_max_history)
+        {
+            total = m_max_history;
+        }
+
+        const auto alpha = T(num_samples) / total;
+        const auto blended = history.radiance + alpha * (radiance - history.radiance);
+
+        m_history[m_current][index(x, y)] = {blended, total};
+        return blended;
+    }
+
+    // Make the current frame the previous one, remembering its camera for
+    // reprojection.
+    void end_frame(const Camera<T>& camera)
+    {
+        m_previous_camera = camera;
+        m_current = previous_index();
+    }
+
+    // Forget all history, e.g. when the scene itself changes.
+    void reset()
+    {
+        m_previous_camera.reset();
+    }
+
+    void set_depth_tolerance(T tolerance) { m_depth_tolerance = tolerance; }
+    void set_normal_tolerance(T tolerance) { m_normal_tolerance = tolerance; }
+    void set_max_history(int max_history) { m_max_history = max_history; }
+
+private:
+    int previous_index() const { return 1 - m_current; }
+
+    // Buffers are stored column by column, like images
+    std::size_t index(int x, int y) const { return (std::size_t)x * height + y; }
+
+    std::vector<GBufferSample<T>> m_gbuffer[2];
+    std::vector<HistorySample<T>> m_history[2];
+    int m_current{0};
+    std::optional<Camera<T>> m_previous_camera;
+
+    // Relative difference allowed between the reprojected and stored depth
+    T m_depth_tolerance{0.02};
+    // Minimum cosine between the current and previous normal
+    T m_normal_tolerance{0.9};
+    // Upper bound on the number of samples in the history, so that the
+    // history keeps adapting to changes in lighting from reprojection error
+    int m_max_history{256};
+};
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// A fixed set of worker threads that run tasks from a shared queue. Tasks
+// with a higher priority run first, tasks of equal priority run in the order
+// they were submitted.
+class ThreadPool
+{
+public:
+    explicit ThreadPool(unsigned num_threads = std::thread::hardware_concurrency())
+    {
+        if (num_threads == 0)
+        {
+            num_threads = 1;
+        }
+
+        for (unsigned i = 0; i < num_threads; ++i)
+        {
+            m_threads.emplace_back([this] { work(); });
+        }
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock{m_mutex};
+            m_stopping = true;
+        }
+        m_condition.notify_all();
+
+        for (auto& thread : m_threads)
+        {
+            thread.join();
+        }
+    }
+
+    void submit(std::function<void()> task, int priority = 0)
+    {
+        {
+            std::lock_guard<std::mutex> lock{m_mutex};
+            m_tasks.push({priority, m_next_sequence++, std::move(task)});
+        }
+        m_condition.notify_one();
+    }
+
+    // Submit several tasks at once, so that no worker can submit tasks of its
+    // own between them
+    void submit(std::vector<std::pair<std::function<void()>, int>> tasks)
+    {
+        {
+            std::lock_guard<std::mutex> lock{m_mutex};
+            for (auto& task : tasks)
+            {
+                m_tasks.push({task.second, m_next_sequence++, std::move(task.first)});
+            }
+        }
+        m_condition.notify_all();
+    }
+
+    unsigned size() const { return m_threads.size(); }
+
+private:
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool(ThreadPool&&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    ThreadPool& operator=(ThreadPool&&) = delete;
+
+    struct Task
+    {
+        int priority;
+        std::uint64_t sequence;
+        std::function<void()> function;
+    };
+
+    struct RunsLater
+    {
+        bool operator()(const Task& t1, const Task& t2) const
+        {
+            if (t1.priority != t2.priority)
+            {
+                return t1.priority < t2.priority;
+            }
+            return t1.sequence > t2.sequence;
+        }
+    };
+
+    void work()
+    {
+        for (;;)
+        {
+            std::function<void()> function;
+            {
+                std::unique_lock<std::mutex> lock{m_mutex};
+                m_condition.wait(lock, [this] {
+                    return m_stopping || !m_tasks.empty();
+                });
+
+                if (m_tasks.empty())
+                {
+                    return;
+                }
+
+                function = std::move(const_cast<Task&>(m_tasks.top()).function);
+                m_tasks.pop();
+            }
+            function();
+        }
+    }
+
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::priority_queue<Task, std::vector<Task>, RunsLater> m_tasks;
+    std::uint64_t m_next_sequence{0};
+    bool m_stopping{false};
+    std::vector<std::thread> m_threads;
+};
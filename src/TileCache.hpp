@@ -0,0 +1,378 @@
+#pragma once
+
+#include "Color.hpp"
+#include "Camera.hpp"
+#include "Scene.hpp"
+#include "Render.hpp"
+#include "Hash.hpp"
+#include "ParallelRender.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// An on-disk cache of rendered tiles, for re-rendering a scene after small
+// edits.
+//
+// A tile is stored in a file named after a hash of everything that decides
+// its rays: camera, image size, tile rectangle, samples, depth and seed.
+// Rendering is deterministic, so the tile only changes if the scene changes
+// along the paths of its rays. While a tile renders, the primitives its rays
+// hit and the grid cells they pass through (up to the hit) are recorded. The
+// file keeps that list together with a hash of the current content of those
+// primitives (geometry and material) and cells (geometry of the spheres in
+// them), and of the grid layout.
+//
+// A cached tile is used when the hash of the same primitives and cells in
+// the current scene is unchanged:
+//  - a new material only invalidates the tiles that hit spheres using it
+//  - a moved sphere only invalidates the tiles that hit it, or whose rays
+//    cross a cell it now overlaps; a closer hit needs a cell on the way
+//  - anything that changes the grid layout (its bounds or resolution, or the
+//    large spheres every ray is tested against) invalidates every tile
+template <typename T>
+class SceneContentHashes
+{
+public:
+    explicit SceneContentHashes(const Scene<T>& scene)
+    {
+        const auto& spheres = scene.spheres();
+        const auto& grid = scene.accelerator();
+
+        std::vector<std::uint64_t> geometry(spheres.size());
+        for (std::size_t i = 0; i < spheres.size(); ++i)
+        {
+            const auto center = spheres[i].center();
+            const T parameters[] = {center.x(), center.y(), center.z(), spheres[i].radius()};
+            geometry[i] = hash_value(parameters);
+            m_primitives.push_back(hash_value(
+                spheres[i].material()->content_hash(), geometry[i]));
+        }
+
+        for (std::size_t cell = 0; cell < grid.num_cells(); ++cell)
+        {
+            std::uint64_t hash = hash_string("cell");
+            const auto range = grid.cell_spheres(cell);
+            for (auto i = range.first; i != range.second; ++i)
+            {
+                hash = hash_value(geometry[*i], hash_value(*i, hash));
+            }
+            m_cells.push_back(hash);
+        }
+
+        m_layout = hash_string("grid");
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            m_layout = hash_value(grid.lower()[axis], m_layout);
+            m_layout = hash_value(grid.upper()[axis], m_layout);
+            m_layout = hash_value(grid.resolution()[axis], m_layout);
+        }
+        for (auto i : grid.large_spheres())
+        {
+            m_layout = hash_value(geometry[i], hash_value(i, m_layout));
+        }
+    }
+
+    // Hash of the content the given primitives and cells have in this scene.
+    // Returns false if they do not exist in it.
+    bool dependency_hash(
+        const std::vector<std::uint32_t>& primitives,
+        const std::vector<std::uint32_t>& cells,
+        std::uint64_t& hash) const
+    {
+        hash = m_layout;
+        for (auto primitive : primitives)
+        {
+            if (primitive >= m_primitives.size())
+            {
+                return false;
+            }
+            hash = hash_value(m_primitives[primitive], hash_value(primitive, hash));
+        }
+        hash = hash_string("cells", hash);
+        for (auto cell : cells)
+        {
+            if (cell >= m_cells.size())
+            {
+                return false;
+            }
+            hash = hash_value(m_cells[cell], hash_value(cell, hash));
+        }
+        return true;
+    }
+
+    std::size_t num_primitives() const { return m_primitives.size(); }
+    std::size_t num_cells() const { return m_cells.size(); }
+
+private:
+    std::vector<std::uint64_t> m_primitives;
+    std::vector<std::uint64_t> m_cells;
+    std::uint64_t m_layout;
+};
+
+// Traces rays against a uniform grid and records which primitives they hit
+// and which cells they pass through on the way
+template <typename T, typename GRID>
+class DependencyRecorder
+{
+public:
+    explicit DependencyRecorder(const GRID& grid)
+        :
+        m_grid{grid},
+        m_primitive_hit(grid.num_primitives(), false),
+        m_cell_visited(grid.num_cells(), false)
+    {}
+
+    bool hit(
+        const Ray3<Point3<T>, Vec3<T>>& ray,
+        T t_min,
+        T t_max,
+        HitRecord<T>& record) const
+    {
+        PrimitiveHit<T> hit;
+        const bool found = m_grid.closest_hit(ray, t_min, t_max, hit);
+        const T t_end = found ? hit.t : t_max;
+        m_grid.walk_cells(ray, t_min, t_end, [&](std::size_t cell) {
+            m_cell_visited[cell] = true;
+            return t_end;
+        });
+
+        if (!found)
+        {
+            return false;
+        }
+        m_primitive_hit[hit.primitive] = true;
+        m_grid.set_hit_record(ray, hit, record);
+        return true;
+    }
+
+    std::vector<std::uint32_t> primitives() const { return indices(m_primitive_hit); }
+    std::vector<std::uint32_t> cells() const { return indices(m_cell_visited); }
+
+private:
+    static std::vector<std::uint32_t> indices(const std::vector<bool>& flags)
+    {
+        std::vector<std::uint32_t> result;
+        for (std::uint32_t i = 0; i < flags.size(); ++i)
+        {
+            if (flags[i])
+            {
+                result.push_back(i);
+            }
+        }
+        return result;
+    }
+
+    const GRID& m_grid;
+    mutable std::vector<bool> m_primitive_hit;
+    mutable std::vector<bool> m_cell_visited;
+};
+
+struct TileCacheStatistics
+{
+    std::atomic<int> cached{0};
+    std::atomic<int> invalidated{0};
+    std::atomic<int> missing{0};
+};
+
+// Render the scene like generate_image_parallel with deterministic sampling,
+// taking the tiles whose rays see no change from the cache in directory and
+// storing the others there. make_scene returns a std::unique_ptr to a Scene;
+// besides the replicas of the NUMA nodes, one is built to hash the content.
+template <typename T, typename Image, typename MakeScene>
+void generate_image_cached(
+    Image& image,
+    MakeScene make_scene,
+    const Camera<T>& camera,
+    int num_samples,
+    int max_depth,
+    unsigned seed,
+    const char* directory,
+    const ParallelRenderOptions& options,
+    TileCacheStatistics& statistics)
+{
+    using SceneType = typename decltype(make_scene())::element_type;
+    using Accelerator = typename SceneType::Accelerator;
+
+    // Bump when anything that affects rendered pixels changes
+    constexpr std::uint32_t version = 2;
+    constexpr char magic[8] = "RTTILE1";
+
+    static_assert(std::is_trivially_copyable<Camera<T>>::value,
+                  "the camera is hashed as bytes");
+
+    struct Header
+    {
+        char magic[8];
+        std::uint64_t key;
+        std::uint64_t dependency_hash;
+        std::uint32_t num_primitives;
+        std::uint32_t num_cells;
+        std::uint32_t num_pixels;
+    };
+
+    const SceneContentHashes<T> hashes{*make_scene()};
+    const TileGrid tiles{(int)image.width, (int)image.height, options.tile_size};
+
+    auto tile_key = [&](int x_begin, int y_begin, int x_end, int y_end) {
+        std::uint64_t key = hash_value(version);
+        key = hash_value(sizeof(T), key);
+        key = hash_value(camera, key);
+        const std::int32_t numbers[] = {
+            (std::int32_t)image.width, (std::int32_t)image.height,
+            x_begin, y_begin, x_end, y_end, num_samples, max_depth};
+        key = hash_value(numbers, key);
+        return hash_value(seed, key);
+    };
+
+    // Fill the tile from its file if the file is for this tile and nothing
+    // its rays depend on has changed
+    auto read_tile = [&](const std::string& path, std::uint64_t key,
+                         int x_begin, int y_begin, int x_end, int y_end) {
+        FILE* file = fopen(path.c_str(), "rb");
+        if (file == nullptr)
+        {
+            return false;
+        }
+
+        // A tile records every primitive and cell at most once, and the file
+        // holds exactly what its header lists. Check both before allocating,
+        // so a damaged file is traced again instead of read.
+        Header header;
+        std::vector<std::uint32_t> primitives, cells;
+        std::vector<std::int32_t> pixels;
+        bool ok = fread(&header, sizeof(header), 1, file) == 1 &&
+            memcmp(header.magic, magic, sizeof(magic)) == 0 &&
+            header.key == key &&
+            header.num_pixels == (std::uint32_t)((x_end - x_begin) * (y_end - y_begin)) &&
+            header.num_primitives <= hashes.num_primitives() &&
+            header.num_cells <= hashes.num_cells();
+        if (ok)
+        {
+            const long expected_size = sizeof(header) + sizeof(std::uint32_t) *
+                ((long)header.num_primitives + header.num_cells + 3L * header.num_pixels);
+            ok = fseek(file, 0, SEEK_END) == 0 && ftell(file) == expected_size &&
+                fseek(file, sizeof(header), SEEK_SET) == 0;
+        }
+        if (ok)
+        {
+            primitives.resize(header.num_primitives);
+            cells.resize(header.num_cells);
+            pixels.resize(3 * header.num_pixels);
+            ok = fread(primitives.data(), sizeof(std::uint32_t), primitives.size(), file) == primitives.size() &&
+                fread(cells.data(), sizeof(std::uint32_t), cells.size(), file) == cells.size() &&
+                fread(pixels.data(), sizeof(std::int32_t), pixels.size(), file) == pixels.size();
+        }
+        fclose(file);
+
+        std::uint64_t dependency_hash;
+        if (!ok ||
+            !hashes.dependency_hash(primitives, cells, dependency_hash) ||
+            dependency_hash != header.dependency_hash)
+        {
+            return false;
+        }
+
+        auto pixel = pixels.data();
+        for (int x = x_begin; x < x_end; ++x)
+        {
+            for (int y = y_begin; y < y_end; ++y, pixel += 3)
+            {
+                image[x][y] = {pixel[0], pixel[1], pixel[2]};
+            }
+        }
+        return true;
+    };
+
+    // Write to a temporary file first, so that a partly written tile is
+    // never found under the tile's name
+    auto write_tile = [&](const std::string& path, std::uint64_t key,
+                          int x_begin, int y_begin, int x_end, int y_end,
+                          const DependencyRecorder<T, Accelerator>& recorder) {
+        const auto primitives = recorder.primitives();
+        const auto cells = recorder.cells();
+
+        Header header{};
+        memcpy(header.magic, magic, sizeof(magic));
+        header.key = key;
+        hashes.dependency_hash(primitives, cells, header.dependency_hash);
+        header.num_primitives = primitives.size();
+        header.num_cells = cells.size();
+        header.num_pixels = (x_end - x_begin) * (y_end - y_begin);
+
+        std::vector<std::int32_t> pixels;
+        for (int x = x_begin; x < x_end; ++x)
+        {
+            for (int y = y_begin; y < y_end; ++y)
+            {
+                const auto pixel = image[x][y];
+                pixels.insert(pixels.end(), {pixel.r(), pixel.g(), pixel.b()});
+            }
+        }
+
+        const auto temporary_path = path + ".tmp";
+        FILE* file = fopen(temporary_path.c_str(), "wb");
+        if (file == nullptr)
+        {
+            fprintf(stderr, "Could not write %s\n", temporary_path.c_str());
+            return;
+        }
+        const bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+            fwrite(primitives.data(), sizeof(std::uint32_t), primitives.size(), file) == primitives.size() &&
+            fwrite(cells.data(), sizeof(std::uint32_t), cells.size(), file) == cells.size() &&
+            fwrite(pixels.data(), sizeof(std::int32_t), pixels.size(), file) == pixels.size();
+        if (fclose(file) != 0 || !ok || rename(temporary_path.c_str(), path.c_str()) != 0)
+        {
+            fprintf(stderr, "Could not write %s\n", path.c_str());
+            remove(temporary_path.c_str());
+        }
+    };
+
+    auto process_tile = [&](int tile, const SceneType& scene) {
+        const auto bounds = tiles.bounds(tile);
+        const int x_begin = bounds.x_begin;
+        const int y_begin = bounds.y_begin;
+        const int x_end = bounds.x_end;
+        const int y_end = bounds.y_end;
+
+        const auto key = tile_key(x_begin, y_begin, x_end, y_end);
+        char name[32];
+        snprintf(name, sizeof(name), "/%016llx.tile", (unsigned long long)key);
+        const std::string path = directory + std::string{name};
+
+        if (read_tile(path, key, x_begin, y_begin, x_end, y_end))
+        {
+            ++statistics.cached;
+            return;
+        }
+        FILE* existing = fopen(path.c_str(), "rb");
+        if (existing != nullptr)
+        {
+            fclose(existing);
+            ++statistics.invalidated;
+        }
+        else
+        {
+            ++statistics.missing;
+        }
+
+        DependencyRecorder<T, Accelerator> recorder{scene.accelerator()};
+        for (int x = x_begin; x < x_end; ++x)
+        {
+            for (int y = y_begin; y < y_end; ++y)
+            {
+                image[x][y] = to_pixel(sample_pixel_deterministic<T>(
+                    x, y, image.width, image.height,
+                    recorder, camera, num_samples, max_depth, seed));
+            }
+        }
+        write_tile(path, key, x_begin, y_begin, x_end, y_end, recorder);
+    };
+
+    for_each_tile_parallel(tiles.num_tiles(), make_scene, process_tile, options);
+}
@@ -1,4 +1,6 @@
 #pragma once
+#include "Math.hpp"
+
 #include <cmath>
 #include <cstdio>
 
@@ -34,33 +36,29 @@ private:
     T m_e[3] = {};
 };
 
-template <typename T>
+template <typename T, typename MATH = ExactMath>
 constexpr inline Vec3<T> unit_vector(const Vec3<T>& v)
 {
-    return v / v.length();
+    return MATH::unit_vector(v);
 }
 
-template <typename T>
+template <typename T, typename MATH = ExactMath>
 constexpr inline T dot(const Vec3<T>& v1, const Vec3<T>& v2)
 {
-    return v1.x() * v2.x() + v1.y() * v2.y() + v1.z() * v2.z();
+    return MATH::dot(v1, v2);
 }
 
-template <typename T>
+template <typename T, typename MATH = ExactMath>
 constexpr inline Vec3<T> cross(const Vec3<T>& v1, const Vec3<T>& v2)
 {
-    return {
-        v1.y() * v2.z() - v1.z() * v2.y(),
-        v1.z() * v2.x() - v1.x() * v2.z(),
-        v1.x() * v2.y() - v1.y() * v2.x()
-    };
+    return MATH::cross(v1, v2);
 }
 
 
-template <typename T>
+template <typename T, typename MATH = ExactMath>
 constexpr inline Vec3<T> reflect(const Vec3<T>& v, const Vec3<T>& n)
 {
-    return v - 2 * dot(v, n) * n;
+    return v - 2 * dot<T, MATH>(v, n) * n;
 }
 
 template <typename T>
@@ -0,0 +1,128 @@
+#pragma once
+
+#include "Point.hpp"
+#include "Vec.hpp"
+#include "Ray.hpp"
+#include "HitRecord.hpp"
+#include "Hit.hpp"
+
+#include <cstdint>
+
+template <typename T, typename SPHERE_CONTAINER>
+class World : public Hittable<T>
+{
+public:
+    World(SPHERE_CONTAINER& sphere_container)
+        :
+        m_spheres{sphere_container}
+    {}
+
+    bool hit(
+        const Ray3<Point3<T>, Vec3<T>>& ray,
+        T t_min,
+        T t_max,
+        HitRecord<T>& record) const override
+    {
+        return closest_hit_record(*this, ray, t_min, t_max, record);
+    }
+
+    bool closest_hit(
+        const Ray3<Point3<T>, Vec3<T>>& ray,
+        T t_min,
+        T t_max,
+        PrimitiveHit<T>& hit) const
+    {
+        bool hit_anything = false;
+        auto closest_so_far = t_max;
+        std::uint32_t index = 0;
+        for (const auto& sphere : m_spheres)
+        {
+            T t;
+            if (sphere.intersect(ray, t_min, closest_so_far, t))
+            {
+                hit_anything = true;
+                closest_so_far = t;
+                hit = {t, index};
+            }
+            ++index;
+        }
+
+        return hit_anything;
+    }
+
+    void set_hit_record(
+        const Ray3<Point3<T>, Vec3<T>>& ray,
+        const PrimitiveHit<T>& hit,
+        HitRecord<T>& record) const
+    {
+        m_spheres[hit.primitive].set_hit_record(ray, hit.t, record);
+    }
+
+    std::size_t num_primitives() const { return m_spheres.size(); }
+
+private:
+    SPHERE_CONTAINER& m_spheres;
+};
+
+// Two hittables traced as one, for example a scene's spheres and a mesh
+template <typename T, typename FIRST, typename SECOND>
+class HitGroup : public Hittable<T>
+{
+public:
+    HitGroup(const FIRST& first, const SECOND& second)
+        :
+        m_first{first},
+        m_second{second}
+    {}
+
+    bool hit(
+        const Ray3<Point3<T>, Vec3<T>>& ray,
+        T t_min,
+        T t_max,
+        HitRecord<T>& record) const override
+    {
+        return closest_hit_record(*this, ray, t_min, t_max, record);
+    }
+
+    // The primitives of the second hittable are numbered after those of
+    // the first
+    bool closest_hit(
+        const Ray3<Point3<T>, Vec3<T>>& ray,
+        T t_min,
+        T t_max,
+        PrimitiveHit<T>& hit) const
+    {
+        bool hit_anything = m_first.closest_hit(ray, t_min, t_max, hit);
+        if (m_second.closest_hit(ray, t_min, hit_anything ? hit.t : t_max, hit))
+        {
+            hit.primitive += m_first.num_primitives();
+            hit_anything = true;
+        }
+        return hit_anything;
+    }
+
+    void set_hit_record(
+        const Ray3<Point3<T>, Vec3<T>>& ray,
+        const PrimitiveHit<T>& hit,
+        HitRecord<T>& record) const
+    {
+        const std::uint32_t num_first = m_first.num_primitives();
+        if (hit.primitive < num_first)
+        {
+            m_first.set_hit_record(ray, hit, record);
+        }
+        else
+        {
+            m_second.set_hit_record(ray, {hit.t, hit.primitive - num_first}, record);
+        }
+    }
+
+    std::size_t num_primitives() const
+    {
+        return m_first.num_primitives() + m_second.num_primitives();
+    }
+
+private:
+    const FIRST& m_first;
+    const SECOND& m_second;
+};
@@ -9,255 +9,947 @@
 #include "Camera.hpp"
 #include "Material.hpp"
 #include "Color.hpp"
-
-#include <array>
-#include <limits>
+#include "Temporal.hpp"
+#include "World.hpp"
+#include "Scene.hpp"
+#include "Render.hpp"
+#include "Server.hpp"
+#include "ParallelRender.hpp"
+#include "Ppm.hpp"
+#include "Regression.hpp"
+#include "Pipeline.hpp"
+#include "TaskGraph.hpp"
+#include "ThreadPool.hpp"
+#include "Mesh.hpp"
+#include "Batch.hpp"
+#include "TileCache.hpp"
+#include "Config.hpp"
+#include "Kernels.hpp"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
 #include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <limits>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+
+using UnderlyingType = double;
+using Vec = Vec3<UnderlyingType>;
+using Point = Point3<UnderlyingType>;
 
-template <typename T, typename SPHERE_CONTAINER>
-class World : public Hittable<T>
+constexpr int max_depth = 50;
+
+// Render a frame of a camera fly-through, reusing the samples of previous
+// frames wherever the surface seen by a pixel was also visible before.
+// A pixel only reads its own samples of the current frame and the buffers
+// of the previous one, so the frame is split into tiles rendered in
+// parallel. The scene replicas are reused for every frame, since only the
+// camera moves. Every sample draws from its own stream derived from seed.
+template <typename Image, typename Accumulator, typename MakeScene, typename Camera>
+void generate_image_temporal(
+    Image& image,
+    Accumulator& accumulator,
+    SceneReplicas<MakeScene>& replicas,
+    const Camera& camera,
+    int num_samples,
+    int depth_limit,
+    std::uint64_t seed,
+    const ParallelRenderOptions& options)
 {
-public:
-    World(SPHERE_CONTAINER& sphere_container)
-        :
-        m_spheres{sphere_container}
-    {}
-
-    bool hit(
-        const Ray3<Point3<T>, Vec3<T>>& ray,
-        T t_min,
-        T t_max,
-        HitRecord<T>& record) const override
-    {
-        bool hit_anything = false;
-        auto closest_so_far = t_max;
-        for (const auto& sphere : m_spheres)
+    const TileGrid tiles{(int)image.width, (int)image.height, options.tile_size};
+
+    using SceneType = typename SceneReplicas<MakeScene>::SceneType;
+    auto render_tile = [&](int tile, const SceneType& scene) {
+        const auto bounds = tiles.bounds(tile);
+        for (int x = bounds.x_begin; x < bounds.x_end; ++x)
         {
-            if (sphere.hit(ray, t_min, closest_so_far, record))
+            for (int y = bounds.y_begin; y < bounds.y_end; ++y)
             {
-                hit_anything = true;
-                closest_so_far = record.t;
+                accumulator.trace_gbuffer(x, y, scene.accelerator(), camera);
+                const auto history = accumulator.reproject(x, y);
+                const auto pixel_color = sample_pixel_deterministic<UnderlyingType>(
+                    x, y, image.width, image.height,
+                    scene.accelerator(), camera, num_samples, depth_limit, seed);
+
+                image[x][y] = to_pixel(accumulator.accumulate(
+                    x, y, history, pixel_color, num_samples));
             }
         }
+    };
 
-        return hit_anything;
-    }
-
-private:
-    SPHERE_CONTAINER& m_spheres;
-};
+    for_each_tile_parallel(tiles.num_tiles(), replicas, render_tile, options);
 
-using UnderlyingType = double;
-using Vec = Vec3<UnderlyingType>;
-using Point = Point3<UnderlyingType>;
-using Ray = Ray3<Point, Vec>;
-using Sphere = Sphere3<UnderlyingType>;
-using LambertianMat = Lambertian<UnderlyingType>;
-using DialectricMat = Dialectric<UnderlyingType>;
-using MetalMat = Metal<UnderlyingType>;
-using PixelColor = Color<UnderlyingType>;
+    accumulator.end_frame(camera);
+}
 
-Rng rng{(unsigned)time(0)};
+// Most frames of a sequence or fly-through, and most scenes of a sequence
+constexpr int max_frames = 100000;
 
-constexpr int max_depth = 50;
-constexpr int num_samples_per_pixel = 100;
-
-constexpr LambertianMat material_ground{Vec{0.5, 0.5, 0.5}};
-constexpr DialectricMat material1{1.5};
-constexpr LambertianMat material2{Vec{0.4, 0.2, 0.1}};
-constexpr MetalMat      material3{Vec{0.7, 0.6, 0.5}, 0};
-
-constexpr auto range_min = -11;
-constexpr auto range_max = 11;
-constexpr int num_random = (range_max - range_min)*(range_max-range_min);
-constexpr int num_lamb = num_random * 0.8;
-constexpr int num_metal = num_random * 0.15;
-constexpr int num_glass = num_random - num_lamb - num_metal;
-
-std::array<Sphere, 4+num_random> spheres = {
-    Sphere{ Point{0, -1000, 0}, 1000, &material_ground },
-    Sphere{ Point{ 0, 1, 0}, 1,       &material1 },
-    Sphere{ Point{-4, 1, 0}, 1,       &material2 },
-    Sphere{ Point{ 4, 1, 0}, 1,       &material3 },
-};
+constexpr auto aspect_ratio = 16.0/9.0;
+constexpr int image_width = 400;
+constexpr int image_height = image_width / aspect_ratio;
 
-std::array<LambertianMat, num_lamb>  material_lamb;
-std::array<MetalMat,      num_metal> material_metal;
-std::array<DialectricMat, num_glass> material_glass;
+// Camera for a frame of a slow orbit around the point looked at, starting
+// from the camera of the settings
+Camera<UnderlyingType> orbit_camera(int frame, int num_frames, const RenderConfig& config)
+{
+    const auto& request = config.request;
+    const auto angle = 0.2 * frame / num_frames;
+    const auto offset = make_vec(request.lookfrom, request.lookat);
+    const auto lookfrom = Point{
+        request.lookat.x() + offset.x() * cos(angle) - offset.z() * sin(angle),
+        request.lookat.y() + offset.y(),
+        request.lookat.z() + offset.x() * sin(angle) + offset.z() * cos(angle)
+    };
 
-World<UnderlyingType, decltype(spheres)> random_world{spheres};
+    return {
+        lookfrom,
+        request.lookat,
+        Vec{0, 1, 0},
+        request.vfov,
+        (UnderlyingType)request.width/request.height,
+        request.aperture,
+        request.focus_dist
+    };
+}
 
-void generate_world()
+// Render the fly-through of the scene generated from scene_seed. Frame N
+// traces spp new samples with the seed (N, scene_seed), so a fly-through is
+// reproducible.
+// Returns false if a frame could not be written.
+bool generate_fly_through(
+    unsigned scene_seed,
+    int num_frames,
+    const RenderConfig& config,
+    const ParallelRenderOptions& options)
 {
-    for (auto& mat : material_lamb)
+    auto make_scene = [scene_seed] {
+        return std::make_unique<const Scene<UnderlyingType>>(scene_seed);
+    };
+    SceneReplicas<decltype(make_scene)> replicas{make_scene, options};
+
+    const auto& request = config.request;
+    MappedImage<Color<int>> image{request.width, request.height};
+    TemporalAccumulator<UnderlyingType> accumulator{request.width, request.height};
+
+    for (int frame = 0; frame < num_frames; ++frame)
     {
-        mat = {Vec{
-                rng.random<UnderlyingType>(),
-                rng.random<UnderlyingType>(),
-                rng.random<UnderlyingType>()}};
+        const auto camera = orbit_camera(frame, num_frames, config);
+
+        generate_image_temporal(
+            image, accumulator, replicas, camera,
+            request.num_samples_per_pixel, request.max_depth,
+            ((std::uint64_t)frame << 32) | scene_seed, options);
+
+        char file_name[32];
+        snprintf(file_name, sizeof(file_name), "frame_%04d.ppm", frame);
+        FILE* file = fopen(file_name, "w");
+        if (file == nullptr)
+        {
+            fprintf(stderr, "Could not open %s\n", file_name);
+            return false;
+        }
+        print_ppm_image(image, file);
+        fclose(file);
     }
+    return true;
+}
+
+// Render an orbit through num_scenes scenes as one task graph, printing how
+// the stages overlapped. Returns false if a frame could not be written.
+bool generate_sequence(
+    int num_sequence_frames,
+    int num_scenes,
+    unsigned scene_seed,
+    const RenderConfig& config,
+    unsigned num_threads)
+{
+    const auto& request = config.request;
 
-    for (auto& mat : material_metal)
+    std::vector<FrameDescription<UnderlyingType>> frames;
+    for (int frame = 0; frame < num_sequence_frames; ++frame)
     {
-        auto albedo = Vec{
-            rng.random<UnderlyingType>(0.5, 1),
-            rng.random<UnderlyingType>(0.5, 1),
-            rng.random<UnderlyingType>(0.5, 1)
-        };
-        auto fuzz = rng.random<UnderlyingType>(0, 0.5);
-        mat = {albedo, fuzz};
+        char file_name[32];
+        snprintf(file_name, sizeof(file_name), "frame_%04d.ppm", frame);
+        frames.push_back({
+            scene_seed + (unsigned)(frame * num_scenes / num_sequence_frames),
+            orbit_camera(frame, num_sequence_frames, config),
+            file_name
+        });
     }
 
-    for (auto& mat : material_glass)
+    PipelineOptions options;
+    options.width = request.width;
+    options.height = request.height;
+    options.num_samples_per_pixel = request.num_samples_per_pixel;
+    options.max_depth = request.max_depth;
+    options.seed = scene_seed;
+
+    ThreadPool pool{num_threads};
+    TaskGraph graph{pool};
+    const bool written = render_sequence(frames, options, graph);
+    graph.print_timings();
+    return written;
+}
+
+// Compare the time to find the closest hit with the linear World scan and
+// with the uniform grid, for scenes with an increasing number of spheres
+void benchmark_grid()
+{
+    using Clock = std::chrono::steady_clock;
+    using Ray = Ray3<Point, Vec>;
+
+    printf("spheres   grid cells       build (ms)   linear (Mrays/s)   grid (Mrays/s)   speedup   mismatches\n");
+
+    for (int lattice_radius : {5, 11, 22, 44, 88})
     {
-        mat = {1.5};
-    }
+        const auto build_start = Clock::now();
+        const Scene<UnderlyingType> scene{1, lattice_radius};
+        const std::chrono::duration<double, std::milli> build_time = Clock::now() - build_start;
+
+        // Camera rays over the lattice and rays in random upward directions
+        // from points on it, like the first bounce off the ground
+        constexpr int num_rays = 20000;
+        Rng ray_rng{1};
+        const auto scale = lattice_radius / 11.0;
+        const Camera<UnderlyingType> camera{
+            Point{13 * scale, 2 * scale, 3 * scale}, Point{0, 0, 0}, Vec{0, 1, 0},
+            20, 16.0 / 9.0, 0, 10
+        };
+        std::vector<Ray> rays;
+        for (int i = 0; i < num_rays / 2; ++i)
+        {
+            rays.push_back(camera.get_pinhole_ray(
+                ray_rng.random<UnderlyingType>(), ray_rng.random<UnderlyingType>()));
+
+            const Point origin{
+                ray_rng.random<UnderlyingType>(-lattice_radius, lattice_radius),
+                0.01,
+                ray_rng.random<UnderlyingType>(-lattice_radius, lattice_radius)};
+            auto direction = random_in_unit_sphere<UnderlyingType>(ray_rng);
+            rays.push_back({origin, Vec{direction.x(), fabs(direction.y()), direction.z()}});
+        }
 
-    int index = 4;
-    for (int a = range_min; a < range_max; a++) {
-        for (int b = range_min; b < range_max; b++) {
-            auto choose_mat = rng.random<UnderlyingType>();
-            Point center(a + 0.9 * rng.random<UnderlyingType>(),
-                         0.2,
-                         b + 0.9 * rng.random<UnderlyingType>());
-
-            if (make_vec(center, Point{4, 0.2, 0}).length() > 0.9) {
-                if (choose_mat < 0.8) {
-                    // diffuse
-                    auto m = rng.random<UnderlyingType>() * num_lamb;
-                    auto& material = material_lamb[(int)m];
-                    spheres[index] = {center, 0.2, &material};
-                } else if (choose_mat < 0.95) {
-                    // metal
-                    auto m = rng.random<UnderlyingType>() * num_metal;
-                    auto& material = material_metal[(int)m];
-                    spheres[index] = {center, 0.2, &material};
-                } else {
-                    // glass
-                    auto m = rng.random<UnderlyingType>() * num_glass;
-                    auto& material = material_glass[(int)m];
-                    spheres[index] = {center, 0.2, &material};
-                }
-                index++;
+        auto trace = [&](const auto& hittable, std::vector<UnderlyingType>& distances) {
+            const auto start = Clock::now();
+            for (const auto& ray : rays)
+            {
+                HitRecord<UnderlyingType> record;
+                const bool hit = hittable.hit(
+                    ray, 0.001, std::numeric_limits<UnderlyingType>::max(), record);
+                distances.push_back(hit ? record.t : -1);
             }
+            const std::chrono::duration<double> elapsed = Clock::now() - start;
+            return num_rays / elapsed.count() / 1e6;
+        };
+
+        std::vector<UnderlyingType> linear_distances, grid_distances;
+        const auto linear_rate = trace(scene.world(), linear_distances);
+        const auto grid_rate = trace(scene.accelerator(), grid_distances);
+
+        int mismatches = 0;
+        for (int i = 0; i < num_rays; ++i)
+        {
+            mismatches += linear_distances[i] != grid_distances[i];
         }
+
+        const auto resolution = scene.accelerator().resolution();
+        char cells[32];
+        snprintf(cells, sizeof(cells), "%dx%dx%d", resolution[0], resolution[1], resolution[2]);
+        printf("%7zu   %-14s   %10.2f   %16.3f   %14.3f   %7.1f   %10d\n",
+               scene.spheres().size(), cells, build_time.count(),
+               linear_rate, grid_rate, grid_rate / linear_rate, mismatches);
     }
 }
 
-template <typename T, typename World>
-PixelColor color(const Ray& ray, const World& world, int depth)
+// Compare rendering with unpinned threads sharing one scene against
+// NUMA-aware rendering, for an increasing number of threads
+void benchmark_numa(int num_samples)
 {
-    HitRecord<T> hit_record;
-
-    if (depth <= 0)
+    const auto nodes = numa_topology();
+    unsigned num_cpus = 0;
+    for (const auto& node : nodes)
     {
-        return {0, 0, 0};
+        num_cpus += node.cpus.size();
     }
+    printf("%zu NUMA node(s), %u CPU(s), %d x %d, %d spp\n",
+           nodes.size(), num_cpus, image_width, image_height, num_samples);
+    printf("threads   shared (s)   numa (s)   speedup\n");
 
-    constexpr T t_min = 0.001;
-    constexpr T t_max = std::numeric_limits<T>::max();
+    const Camera<UnderlyingType> camera{
+        Point{13, 2, 3}, Point{0, 0, 0}, Vec{0, 1, 0}, 20,
+        (UnderlyingType)image_width/image_height, 0.1, 10
+    };
 
-    if (world.hit(ray, t_min, t_max, hit_record))
+    for (unsigned num_threads = 1; ; num_threads *= 2)
     {
-        Ray scattered;
-        Vec attenuation;
-        bool ray_was_scattered = hit_record.material->scatter(
-            ray, hit_record, attenuation, scattered, rng);
+        num_threads = std::min(num_threads, num_cpus);
 
-        if (ray_was_scattered)
+        double seconds[2];
+        for (int numa_aware = 0; numa_aware < 2; ++numa_aware)
         {
-            auto pixel_color = color<T, World>(scattered, world, depth-1);
-            return attenuation * pixel_color;
+            MappedImage<Color<int>> bench_image{image_width, image_height};
+            ParallelRenderOptions options;
+            options.num_threads = num_threads;
+            options.numa_aware = numa_aware;
+
+            const auto start = std::chrono::steady_clock::now();
+            generate_image_parallel<UnderlyingType>(
+                bench_image, 1, camera, num_samples, max_depth, 1, options);
+            const std::chrono::duration<double> elapsed =
+                std::chrono::steady_clock::now() - start;
+            seconds[numa_aware] = elapsed.count();
         }
-        else
+
+        printf("%7u   %10.3f   %8.3f   %7.2f\n", num_threads,
+               seconds[0], seconds[1], seconds[0] / seconds[1]);
+
+        if (num_threads == num_cpus)
         {
-            return {0, 0, 0};
+            break;
         }
     }
-    else
-    {
-        auto unit_direction = unit_vector(ray.direction());
-        auto t = (unit_direction.y() + 1) / 2;
-        auto result = (1 - t) * Vec{1.0, 1.0, 1.0} +
-                           t  * Vec{0.5, 0.7, 1.0};
-        return {result.x(), result.y(), result.z()};
-    }
 }
 
-template <typename Image, typename World, typename Camera>
-void generate_image(
-    Image& image,
-    const World& world,
-    const Camera& camera)
+// Speed and largest error of the math kernels in precision Real with policy
+// MATH, on random inputs. Errors are relative to the magnitude of the inputs and measured
+// against long double references.
+template <typename Real, typename MATH>
+void benchmark_math_kernels(const char* precision_name, const char* policy_name)
 {
-    for (int y = 0; y < image.height; ++y)
+    using Clock = std::chrono::steady_clock;
+    using RealVec = Vec3<Real>;
+    using RealPoint = Point3<Real>;
+    using Reference = long double;
+
+    constexpr int num_inputs = 1 << 16;
+    constexpr int num_repeats = 64;
+
+    Rng input_rng{1};
+    std::vector<RealVec> a, b;
+    std::vector<Real> cosines;
+    for (int i = 0; i < num_inputs; ++i)
     {
-        for (int x = 0; x < image.width; ++x)
+        a.push_back({input_rng.random<Real>(-10, 10), input_rng.random<Real>(-10, 10), input_rng.random<Real>(-10, 10)});
+        b.push_back({input_rng.random<Real>(-10, 10), input_rng.random<Real>(-10, 10), input_rng.random<Real>(-10, 10)});
+        cosines.push_back(input_rng.random<Real>());
+    }
+
+    auto length = [](const RealVec& v) {
+        return std::sqrt((Reference)v.x() * v.x() + (Reference)v.y() * v.y() + (Reference)v.z() * v.z());
+    };
+
+    // Run kernel over every input num_repeats times, then once more to
+    // find the largest error
+    auto report = [&](const char* kernel, auto&& run, auto&& error) {
+        Real sink = 0;
+        const auto start = Clock::now();
+        for (int repeat = 0; repeat < num_repeats; ++repeat)
         {
-            PixelColor pixel_color{0, 0, 0};
-            for (int sample = 0; sample < num_samples_per_pixel; ++sample)
+            for (int i = 0; i < num_inputs; ++i)
             {
-                const auto u = (x + rng.random<UnderlyingType>())/(image.width-1);
-                const auto v = (y + rng.random<UnderlyingType>())/(image.height-1);
-                const auto ray = camera.get_ray(u, v, rng);
+                sink += run(i);
+            }
+        }
+        const std::chrono::duration<double> elapsed = Clock::now() - start;
+        // Keep the results alive so the loop is not optimized away
+        volatile Real keep = sink;
+        (void)keep;
+
+        Reference max_error = 0;
+        for (int i = 0; i < num_inputs; ++i)
+        {
+            max_error = std::max(max_error, error(i));
+        }
 
-                pixel_color = pixel_color + color<UnderlyingType, World>(ray, world, max_depth);
+        printf("%-12s %-6s %-6s %10.1f %14.3g\n", kernel, precision_name, policy_name,
+               (double)num_inputs * num_repeats / elapsed.count() / 1e6,
+               (double)max_error);
+    };
+
+    report("unit_vector",
+        [&](int i) { return unit_vector<Real, MATH>(a[i]).x(); },
+        [&](int i) {
+            const auto u = unit_vector<Real, MATH>(a[i]);
+            const auto l = length(a[i]);
+            return std::max({
+                std::fabs(u.x() - a[i].x() / l),
+                std::fabs(u.y() - a[i].y() / l),
+                std::fabs(u.z() - a[i].z() / l)});
+        });
+
+    report("dot",
+        [&](int i) { return dot<Real, MATH>(a[i], b[i]); },
+        [&](int i) {
+            const Reference d = (Reference)a[i].x() * b[i].x() +
+                (Reference)a[i].y() * b[i].y() + (Reference)a[i].z() * b[i].z();
+            return std::fabs(dot<Real, MATH>(a[i], b[i]) - d) / (length(a[i]) * length(b[i]));
+        });
+
+    report("cross",
+        [&](int i) { return cross<Real, MATH>(a[i], b[i]).y(); },
+        [&](int i) {
+            const auto c = cross<Real, MATH>(a[i], b[i]);
+            const Reference x = (Reference)a[i].y() * b[i].z() - (Reference)a[i].z() * b[i].y();
+            const Reference y = (Reference)a[i].z() * b[i].x() - (Reference)a[i].x() * b[i].z();
+            const Reference z = (Reference)a[i].x() * b[i].y() - (Reference)a[i].y() * b[i].x();
+            return std::max({std::fabs(c.x() - x), std::fabs(c.y() - y), std::fabs(c.z() - z)}) /
+                (length(a[i]) * length(b[i]));
+        });
+
+    report("reflectance",
+        [&](int i) { return reflectance<Real, MATH>(cosines[i], (Real)1.5); },
+        [&](int i) {
+            const Reference r0 = (1 - 1.5L) / (1 + 1.5L);
+            const Reference r = r0 * r0 + (1 - r0 * r0) * std::pow(1 - (Reference)cosines[i], 5);
+            return std::fabs(reflectance<Real, MATH>(cosines[i], (Real)1.5) - r);
+        });
+
+    // Rays from a[i] towards a sphere of radius 5 at the origin; the error is
+    // relative to the distance, and rays where the policies disagree on
+    // whether there is a hit at all count as an error of 1
+    const Lambertian<Real, MATH> material{RealVec{0.5, 0.5, 0.5}};
+    const Sphere3<Real, MATH> sphere{RealPoint{0, 0, 0}, 5, &material};
+    const Sphere3<Real> exact_sphere{RealPoint{0, 0, 0}, 5, &material};
+    auto sphere_ray = [&](int i) {
+        const RealPoint origin{2 * a[i].x(), 2 * a[i].y(), 2 * a[i].z()};
+        return Ray3<RealPoint, RealVec>{origin, make_vec(RealPoint{b[i].x() / 2, b[i].y() / 2, b[i].z() / 2}, origin)};
+    };
+    report("sphere",
+        [&](int i) {
+            Real t = 0;
+            sphere.intersect(sphere_ray(i), (Real)0.001, std::numeric_limits<Real>::max(), t);
+            return t;
+        },
+        [&](int i) {
+            const auto ray = sphere_ray(i);
+            Real t = 0, exact_t = 0;
+            const bool hit = sphere.intersect(ray, (Real)0.001, std::numeric_limits<Real>::max(), t);
+            const bool exact_hit = exact_sphere.intersect(ray, (Real)0.001, std::numeric_limits<Real>::max(), exact_t);
+            if (hit != exact_hit)
+            {
+                return (Reference)1;
             }
-            pixel_color = pixel_color / (UnderlyingType) num_samples_per_pixel;
+            return hit ? std::fabs((Reference)t - exact_t) / exact_t : 0;
+        });
+}
 
-            pixel_color = gamma_correct(pixel_color);
+// Compare the math policies kernel by kernel, then render the cover scene
+// with each and compare the images
+void benchmark_math(int num_samples)
+{
+    printf("kernel       type   policy    Mops/s      max error\n");
+    benchmark_math_kernels<float, ExactMath>("float", "exact");
+    benchmark_math_kernels<float, FastMath>("float", "fast");
+    benchmark_math_kernels<double, ExactMath>("double", "exact");
+    benchmark_math_kernels<double, FastMath>("double", "fast");
+#if defined(__FP_FAST_FMA) && defined(__FP_FAST_FMAF)
+    printf("fast math fuses multiply-adds\n");
+#else
+    printf("fast math does not fuse multiply-adds, build with -mfma to enable\n");
+#endif
+
+    const Camera<UnderlyingType> camera{
+        Point{13, 2, 3}, Point{0, 0, 0}, Vec{0, 1, 0}, 20,
+        (UnderlyingType)image_width/image_height, 0.1, 10
+    };
+    ParallelRenderOptions options;
+    options.deterministic = true;
+
+    auto render = [&](auto make_scene, MappedImage<Color<int>>& result) {
+        const auto start = std::chrono::steady_clock::now();
+        generate_image_parallel<UnderlyingType>(
+            result, make_scene, camera, num_samples, max_depth, 1, options);
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        return elapsed.count();
+    };
 
-            image[x][y] = {
-                int(255.99f * pixel_color.r()),
-                int(255.99f * pixel_color.g()),
-                int(255.99f * pixel_color.b())
-            };
-        }
+    MappedImage<Color<int>> exact_image{image_width, image_height};
+    MappedImage<Color<int>> fast_image{image_width, image_height};
+    const auto exact_seconds = render(
+        [] { return std::make_unique<const Scene<UnderlyingType, ExactMath>>(1); }, exact_image);
+    const auto fast_seconds = render(
+        [] { return std::make_unique<const Scene<UnderlyingType, FastMath>>(1); }, fast_image);
+
+    const auto comparison = compare_images(to_ppm_image(fast_image), to_ppm_image(exact_image));
+    printf("\nrender %d x %d, %d spp: exact %.2f s, fast %.2f s, speedup %.2f\n",
+           image_width, image_height, num_samples,
+           exact_seconds, fast_seconds, exact_seconds / fast_seconds);
+    printf("fast vs exact: %s, psnr %.1f dB, block psnr %.1f dB, max block diff %.1f, bias %+.2f %+.2f %+.2f\n",
+           comparison.identical ? "identical" : "differs",
+           comparison.psnr, comparison.block_psnr, comparison.max_block_difference,
+           comparison.bias[0], comparison.bias[1], comparison.bias[2]);
+}
+
+// Render the default view with the kernel specialized for its depth limit and
+// with the generic kernel, which checks the depth at run time
+template <typename T, typename MATH>
+void benchmark_kernel(const char* name, int num_samples)
+{
+    RenderConfig config;
+    config.request.num_samples_per_pixel = num_samples;
+    ParallelRenderOptions options;
+    options.deterministic = true;
+    const auto no_edits = [](auto&) { return true; };
+
+    auto time = [](auto render) {
+        const auto start = std::chrono::steady_clock::now();
+        render();
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        return elapsed.count();
+    };
+
+    const auto& request = config.request;
+    MappedImage<Color<int>> specialized{request.width, request.height};
+    MappedImage<Color<int>> generic{request.width, request.height};
+    const auto specialized_seconds = time([&] {
+        render_kernel<T, MATH>(specialized, config, FixedDepth<50>{}, 1, options, no_edits);
+    });
+    const auto generic_seconds = time([&] {
+        render_kernel<T, MATH>(generic, config, 50, 1, options, no_edits);
+    });
+
+    const auto comparison = compare_images(to_ppm_image(specialized), to_ppm_image(generic));
+    printf("%-14s %11.2f s %9.2f s %8.2f   %s\n", name,
+           specialized_seconds, generic_seconds, generic_seconds / specialized_seconds,
+           comparison.identical ? "identical" : "DIFFERENT");
+}
+
+void benchmark_kernels(int num_samples)
+{
+    printf("kernel          specialized     generic  speedup   images\n");
+    benchmark_kernel<double, ExactMath>("double exact", num_samples);
+    benchmark_kernel<double, FastMath>("double fast", num_samples);
+    benchmark_kernel<float, ExactMath>("float exact", num_samples);
+    benchmark_kernel<float, FastMath>("float fast", num_samples);
+}
+
+// Parse a whole number from minimum to maximum given on the command line
+bool parse_count(const char* text, long minimum, long maximum, int& count)
+{
+    char* text_end;
+    errno = 0;
+    const long value = strtol(text, &text_end, 10);
+    if (text_end == text || *text_end != '\0' || errno != 0 ||
+        value < minimum || value > maximum)
+    {
+        return false;
     }
+    count = value;
+    return true;
 }
 
-template <typename Image>
-void print_ppm_image(const Image& image)
+// A change to the generated scene given on the command line
+struct SphereEdit
 {
-    // Print the image header first
-    printf("P3\n");
-    printf("%d %d\n", image.width, image.height);
-    printf("255\n");
+    enum Kind { move, recolor };
 
-    for (int y = image.height-1; y >= 0; --y)
+    Kind kind;
+    std::size_t index;
+    Vec value;
+};
+
+bool parse_sphere_edit(SphereEdit::Kind kind, const char* text, SphereEdit& edit)
+{
+    std::size_t index;
+    UnderlyingType x, y, z;
+    if (sscanf(text, "%zu,%lf,%lf,%lf", &index, &x, &y, &z) != 4)
+    {
+        return false;
+    }
+    edit = {kind, index, Vec{x, y, z}};
+    return true;
+}
+
+template <typename T, typename MATH>
+bool apply_sphere_edits(Scene<T, MATH>& scene, const std::vector<SphereEdit>& edits)
+{
+    for (const auto& edit : edits)
     {
-        for (int x = 0; x < image.width; ++x)
+        if (edit.index >= scene.spheres().size())
         {
-            auto pixel = image[x][y];
-            printf("%d %d %d\n", pixel.r(), pixel.g(), pixel.b());
+            fprintf(stderr, "There is no sphere %zu, the scene has %zu\n",
+                    edit.index, scene.spheres().size());
+            return false;
+        }
+
+        const Vec3<T> value{(T)edit.value.x(), (T)edit.value.y(), (T)edit.value.z()};
+        if (edit.kind == SphereEdit::move)
+        {
+            scene.move_sphere(edit.index, value);
+        }
+        else
+        {
+            scene.recolor_sphere(edit.index, value);
         }
     }
+    return true;
 }
 
-constexpr auto aspect_ratio = 16.0/9.0;
-constexpr int image_width = 400;
-constexpr int image_height = image_width / aspect_ratio;
+// Render every view listed in a file of the scene generated from scene_seed
+bool generate_batch(const char* path, unsigned scene_seed, unsigned num_threads)
+{
+    std::vector<BatchView<UnderlyingType>> views;
+    std::string error;
+    if (!read_batch_views(path, scene_seed, views, error))
+    {
+        fprintf(stderr, "%s: %s\n", path, error.c_str());
+        return false;
+    }
+    if (views.empty())
+    {
+        fprintf(stderr, "%s: no views\n", path);
+        return false;
+    }
 
-Image<Color<int>, image_width, image_height> image;
+    ParallelRenderOptions options;
+    options.num_threads = num_threads;
+    BatchStatistics statistics;
+    const bool written = render_batch(
+        views,
+        [scene_seed] { return std::make_unique<const Scene<UnderlyingType>>(scene_seed); },
+        options, statistics);
+
+    fprintf(stderr, "%zu views, %.2f Mpixels, %.1f Msamples, %.1f Mrays in %.2f s: %.3f Mrays/s\n",
+            views.size(), statistics.num_pixels / 1e6, statistics.num_samples / 1e6,
+            statistics.num_rays / 1e6, statistics.seconds,
+            statistics.num_rays / statistics.seconds / 1e6);
+    return written;
+}
 
-int main()
+// Render a PLY or OBJ mesh standing on the ground, scaled to be about as
+// large as the big spheres of the cover scene
+template <typename Image>
+bool generate_mesh_image(
+    Image& image,
+    const char* path,
+    const RenderConfig& config,
+    unsigned seed,
+    const ParallelRenderOptions& options)
 {
-    constexpr auto lookfrom = Point{13, 2, 3};
-    constexpr auto lookat = Point{0, 0, 0};
+    using Clock = std::chrono::steady_clock;
 
-    constexpr Camera<UnderlyingType> camera{
-        lookfrom,
-        lookat,
-        Vec{0, 1, 0},
-        20,
-        (UnderlyingType)image.width/image.height,
-        0.1,
-        10
+    const Metal<UnderlyingType> material{Vec{0.7, 0.6, 0.5}, 0.05};
+    std::string error;
+    const auto load_start = Clock::now();
+    auto mesh = TriangleMesh<UnderlyingType>::load(path, &material, error);
+    if (!mesh)
+    {
+        fprintf(stderr, "Could not load %s: %s\n", path, error.c_str());
+        return false;
+    }
+    const std::chrono::duration<double, std::milli> load_time = Clock::now() - load_start;
+    fprintf(stderr, "%s: %zu vertices, %zu triangles, loaded in %.1f ms\n",
+            path, mesh->num_vertices(), mesh->num_triangles(), load_time.count());
+
+    const auto lower = mesh->lower();
+    const auto upper = mesh->upper();
+    const auto extent = std::max({
+        upper.x() - lower.x(), upper.y() - lower.y(), upper.z() - lower.z()});
+    const UnderlyingType scale = extent > 0 ? 2 / extent : 1;
+    mesh->set_placement(
+        Vec{
+            -scale * (lower.x() + upper.x()) / 2,
+            -scale * lower.y(),
+            -scale * (lower.z() + upper.z()) / 2},
+        scale);
+
+    using MeshType = TriangleMesh<UnderlyingType>;
+    generate_image_parallel<UnderlyingType>(
+        image,
+        [&mesh] { return std::make_unique<const MeshScene<UnderlyingType, MeshType>>(*mesh); },
+        config.camera<UnderlyingType>(), config.request.num_samples_per_pixel,
+        config.request.max_depth, seed, options);
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc >= 2 && strcmp(argv[1], "--server") == 0)
+    {
+        const char* socket_path = argc >= 3 ? argv[2] : "/tmp/ray_tracer.sock";
+        RenderServer<UnderlyingType> server{
+            socket_path, num_allowed_cpus(), 8};
+        return server.run() ? 0 : 1;
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "--bench-grid") == 0)
+    {
+        benchmark_grid();
+        return 0;
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "--bench-numa") == 0)
+    {
+        benchmark_numa(argc >= 3 ? atoi(argv[2]) : 10);
+        return 0;
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "--bench-math") == 0)
+    {
+        benchmark_math(argc >= 3 ? atoi(argv[2]) : 20);
+        return 0;
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "--bench-kernels") == 0)
+    {
+        benchmark_kernels(argc >= 3 ? atoi(argv[2]) : 20);
+        return 0;
+    }
+
+    // Without a seed every run is different. With one, the render is
+    // deterministic: bit-identical for any number of threads.
+    unsigned scene_seed = time(0);
+    bool deterministic = false;
+    unsigned num_threads = num_allowed_cpus();
+    const char* regression_directory = nullptr;
+    bool update_golden_images = false;
+    RegressionTolerance tolerance;
+    int num_sequence_frames = 0;
+    int num_fly_through_frames = 0;
+    int num_scenes = 1;
+    const char* mesh_path = nullptr;
+    const char* views_path = nullptr;
+    const char* cache_directory = nullptr;
+    std::vector<SphereEdit> edits;
+    RenderConfig config;
+    bool has_settings = false;
+
+    // Read the count after the option at argv[i], from 1 to maximum
+    auto read_count = [argv](int& i, long maximum, int& count) {
+        if (!parse_count(argv[i + 1], 1, maximum, count))
+        {
+            fprintf(stderr, "Expected a number from 1 to %ld after %s\n", maximum, argv[i]);
+            return false;
+        }
+        ++i;
+        return true;
     };
 
-    generate_world();
-    generate_image(image, random_world, camera);
-    print_ppm_image(image);
+    for (int i = 1; i < argc; ++i)
+    {
+        const bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--seed") == 0 && has_value)
+        {
+            scene_seed = strtoul(argv[++i], nullptr, 10);
+            deterministic = true;
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && has_value)
+        {
+            // More threads than CPUs only helps up to a point
+            int count;
+            if (!read_count(i, 16L * num_allowed_cpus(), count))
+            {
+                return 2;
+            }
+            num_threads = count;
+        }
+        else if (strcmp(argv[i], "--sequence") == 0 && has_value)
+        {
+            if (!read_count(i, max_frames, num_sequence_frames))
+            {
+                return 2;
+            }
+        }
+        else if (strcmp(argv[i], "--fly-through") == 0 && has_value)
+        {
+            if (!read_count(i, max_frames, num_fly_through_frames))
+            {
+                return 2;
+            }
+        }
+        else if (strcmp(argv[i], "--scenes") == 0 && has_value)
+        {
+            if (!read_count(i, max_frames, num_scenes))
+            {
+                return 2;
+            }
+        }
+        else if (strcmp(argv[i], "--mesh") == 0 && has_value)
+        {
+            mesh_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--views") == 0 && has_value)
+        {
+            views_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--cache") == 0 && has_value)
+        {
+            cache_directory = argv[++i];
+        }
+        else if ((strcmp(argv[i], "--move-sphere") == 0 ||
+                  strcmp(argv[i], "--recolor-sphere") == 0) && has_value)
+        {
+            const auto kind = strcmp(argv[i], "--move-sphere") == 0 ?
+                SphereEdit::move : SphereEdit::recolor;
+            SphereEdit edit;
+            if (!parse_sphere_edit(kind, argv[++i], edit))
+            {
+                fprintf(stderr, "Expected <index>,<x>,<y>,<z> after %s\n", argv[i - 1]);
+                return 2;
+            }
+            edits.push_back(edit);
+        }
+        else if (strcmp(argv[i], "--config") == 0 && has_value)
+        {
+            std::string error;
+            if (!read_render_config(argv[++i], config, error))
+            {
+                fprintf(stderr, "%s: %s\n", argv[i], error.c_str());
+                return 2;
+            }
+            has_settings = true;
+        }
+        else if (argv[i][0] != '-' && strchr(argv[i], '=') != nullptr)
+        {
+            std::string error;
+            if (!parse_render_config(argv[i], config, error))
+            {
+                fprintf(stderr, "%s\n", error.c_str());
+                return 2;
+            }
+            has_settings = true;
+        }
+        else if (strcmp(argv[i], "--regression") == 0 && has_value)
+        {
+            regression_directory = argv[++i];
+        }
+        else if (strcmp(argv[i], "--update") == 0)
+        {
+            update_golden_images = true;
+        }
+        else if (strcmp(argv[i], "--min-psnr") == 0 && has_value)
+        {
+            tolerance.min_block_psnr = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--max-block-diff") == 0 && has_value)
+        {
+            tolerance.max_block_difference = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--max-bias") == 0 && has_value)
+        {
+            tolerance.max_bias = atof(argv[++i]);
+        }
+        else
+        {
+            fprintf(stderr, "Unknown argument: %s\n", argv[i]);
+            return 2;
+        }
+    }
+
+    // The regression suite and batches render views that carry their own
+    // settings
+    if (has_settings && (regression_directory != nullptr || views_path != nullptr))
+    {
+        fprintf(stderr, "render settings can not be given with --regression or --views\n");
+        return 2;
+    }
+
+    if (regression_directory != nullptr)
+    {
+        const int num_failures = run_regression_suite<UnderlyingType>(
+            regression_directory, update_golden_images, tolerance, num_threads);
+        return num_failures == 0 ? 0 : 1;
+    }
+
+    if (views_path != nullptr)
+    {
+        return generate_batch(views_path, scene_seed, num_threads) ? 0 : 1;
+    }
+
+    // Only the scene render has kernels for other precisions and policies
+    if ((config.precision != RenderConfig::double_precision ||
+         config.math != RenderConfig::exact_math) &&
+        (num_sequence_frames > 0 || num_fly_through_frames > 0 ||
+         cache_directory != nullptr || mesh_path != nullptr))
+    {
+        fprintf(stderr, "precision and math can not be changed for sequences, fly-throughs, meshes or cached renders\n");
+        return 2;
+    }
+
+    ParallelRenderOptions options;
+    options.num_threads = num_threads;
+    options.deterministic = deterministic;
+
+    if (num_sequence_frames > 0)
+    {
+        return generate_sequence(
+            num_sequence_frames, num_scenes, scene_seed, config, num_threads) ? 0 : 1;
+    }
+
+    if (num_fly_through_frames > 0)
+    {
+        return generate_fly_through(scene_seed, num_fly_through_frames, config, options) ? 0 : 1;
+    }
+
+    MappedImage<Color<int>> output{config.request.width, config.request.height};
+
+    if (cache_directory != nullptr)
+    {
+        if (!deterministic)
+        {
+            fprintf(stderr, "--cache needs a --seed\n");
+            return 2;
+        }
+
+        if (mkdir(cache_directory, 0755) != 0 && errno != EEXIST)
+        {
+            perror(cache_directory);
+            return 1;
+        }
+
+        // Check the edits on a scene of their own, so that every NUMA node
+        // builds its replica on its own CPUs
+        {
+            Scene<UnderlyingType> checked_scene{scene_seed};
+            if (!apply_sphere_edits(checked_scene, edits))
+            {
+                return 2;
+            }
+        }
+
+        TileCacheStatistics statistics;
+        generate_image_cached(
+            output,
+            [&] {
+                auto scene = std::make_unique<Scene<UnderlyingType>>(scene_seed);
+                apply_sphere_edits(*scene, edits);
+                return std::unique_ptr<const Scene<UnderlyingType>>{std::move(scene)};
+            },
+            config.camera<UnderlyingType>(),
+            config.request.num_samples_per_pixel, config.request.max_depth,
+            scene_seed, cache_directory, options, statistics);
+        fprintf(stderr, "Tiles: %d cached, %d invalidated, %d not in the cache\n",
+                statistics.cached.load(), statistics.invalidated.load(),
+                statistics.missing.load());
+        print_ppm_image(output);
+        return 0;
+    }
+
+    if (mesh_path != nullptr)
+    {
+        if (!generate_mesh_image(output, mesh_path, config, scene_seed, options))
+        {
+            return 1;
+        }
+        print_ppm_image(output);
+        return 0;
+    }
+
+    if (!render_configured(
+            output, config, scene_seed, options,
+            [&](auto& scene) { return apply_sphere_edits(scene, edits); }))
+    {
+        return 2;
+    }
+    print_ppm_image(output);
 
     return 0;
 }